@@ -38,6 +38,52 @@ uint16_t bit_reverse(uint16_t num)
     return reverse;
 }
 
+/*
+ *  name: si8900_sync_frame
+ *
+ *  desc: scans a raw byte stream for the next complete frame
+ *
+ *  args:
+ *      const uint8_t* in : raw bytes received from the si8900
+ *      size_t len        : number of bytes in 'in'
+ *      size_t pos        : offset to start scanning from
+ *
+ *  return value:
+ *      size_t: offset of the next complete frame at or after pos.
+ *              If there is none, the offset of the first byte that could
+ *              still start a frame once more data arrives (len if none),
+ *              so (return + SI8900_FRAME_LEN > len) means no frame found.
+ *
+ *  example:
+ *      pos = si8900_sync_frame(buf, len, pos);
+ *      if (pos + SI8900_FRAME_LEN <= len)
+ *      {
+ *          // buf + pos is a full frame
+ *      }
+ */
+size_t si8900_sync_frame(const uint8_t* in, size_t len, size_t pos)
+{
+    while (pos + SI8900_FRAME_LEN <= len)
+    {
+        if (IS_FRAME(in + pos))
+        {
+            return pos;
+        }
+        pos++; // not aligned on a frame, resync on next byte
+    }
+    // drop trailing bytes that can not be the start of a frame
+    while (pos < len)
+    {
+        if (IS_CMD_BYTE(in[pos]) && (pos + 1 >= len || IS_DATA1_BYTE(in[pos + 1])))
+        {
+            break;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+#ifndef PC_
 /*
  *  name: si8900_auto_baud
  *
@@ -94,6 +140,7 @@ uint8_t si8900_auto_baud(void)
     }
     return 0;
 }
+#endif /* PC_ */
 
 
 
@@ -194,6 +241,59 @@ si8900_reading si8900_get_reading_oversampled(uint8_t* buffer, uint8_t ref_byte,
 }
 
 
+/*
+ *  name: si8900_decode_frames
+ *
+ *  desc: decodes every complete frame in a raw byte stream into a
+ *        caller provided array of si8900_reading structs. No allocation
+ *        is done. Bytes that can not start a frame are skipped so the
+ *        decoder resyncs on its own after line noise. A partial frame at
+ *        the end of the input is left unconsumed so the caller can keep
+ *        it and prepend it to the next chunk.
+ *
+ *  args:
+ *      const uint8_t* in      : raw bytes received from the si8900
+ *      size_t len             : number of bytes in 'in'
+ *      si8900_reading* out    : array to write decoded readings into
+ *      size_t out_cap         : number of entries available in 'out'
+ *      size_t* consumed       : set to the number of bytes of 'in' used up,
+ *                               may be NULL
+ *
+ *  return value:
+ *      size_t: number of readings written to 'out'
+ *
+ *  example:
+ *      si8900_reading readings[32];
+ *      size_t used;
+ *      size_t n = si8900_decode_frames(rx_buf, rx_len, readings, 32, &used);
+ *      // process readings[0 .. n-1], keep rx_buf[used .. rx_len-1] for next call
+ */
+size_t si8900_decode_frames(const uint8_t* in, size_t len, si8900_reading* out, size_t out_cap, size_t* consumed)
+{
+    size_t pos = 0, count = 0;
+
+    while (count < out_cap)
+    {
+        pos = si8900_sync_frame(in, len, pos);
+        if (pos + SI8900_FRAME_LEN > len)
+        {
+            break; // nothing but a partial frame left
+        }
+        out[count].cmd_byte = in[pos];
+        out[count].inch = GET_INCH(in[pos + 1]);
+        out[count].reading = GET_READING(PACKET_JOIN(in[pos + 1], in[pos + 2]));
+        count++;
+        pos += SI8900_FRAME_LEN;
+    }
+
+    if (consumed)
+    {
+        *consumed = pos;
+    }
+    return count;
+}
+
+
 /*
  *  name: si8900_send_cmd
  *
@@ -209,6 +309,7 @@ si8900_reading si8900_get_reading_oversampled(uint8_t* buffer, uint8_t ref_byte,
  *      si8900_send_cmd(GP_SINGLE_READ_0);
  *
  */
+#ifndef PC_
 //todo make sure this function actually works --
 /// thinking the pulling off the buffer is bad --
 /// alternatively remove the check in the get_reading functions
@@ -222,3 +323,4 @@ void si8900_send_cmd(si8900_cfg cmd_byte)
         hold_value = UART_RX_BUFF;
     } while(hold_value != cmd_byte);
 }
+#endif /* PC_ */
@@ -9,9 +9,12 @@
  *      MAINS_US_ : enables US characterization values (eg: 120Vrms 60Hz)
  *      MAINS_EU_ : enables US characterization values (eg: 220Vrms 50Hz)
  *
- *  ONLY use ONE or the other of the values: -- define in build config
+ *  ONLY use ONE of the values: -- define in build config
  *      MSP_ : uses MSP430 libs
  *      PIC_ : uses PIC libs
+ *      PC_  : host build, no UART register access. Raw bytes are read by the
+ *             application (serial port, capture file) and handed to the
+ *             byte processing functions.
  *
  *      NOTE: PIC is not implemented yet.
  *
@@ -29,6 +32,7 @@
  * includes
  */
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef MSP_
     #include <msp430.h>
@@ -44,8 +48,10 @@
     #define UART_TX_IFG  "NOT IMPLRMENTED"
     #define UART_RX_IFG  "NOT IMPLRMENTED"
     #define UART_IFG_REG "NOT IMPLRMENTED"
+#elif defined(PC_)
+    // no UART registers on the host, TX/RX commands are not built
 #else
-    #error "No valid hardware option chosen. Check build options. either \"MSP_\" or \"PIC_\" Must be defined."
+    #error "No valid hardware option chosen. Check build options. either \"MSP_\", \"PIC_\" or \"PC_\" Must be defined."
 #endif
 
 
@@ -89,6 +95,7 @@ typedef  uint8_t si8900_cfg;
 #define INCH_0      ((uint8_t)(0xC0u))      // input channel 0
 #define INCH_1      ((uint8_t)(0xD0u))      // input channel 1
 #define INCH_2      ((uint8_t)(0xE0u))      // input channel 2
+#define SI8900_NUM_CH   3                   // number of input channels
 
 
 /*
@@ -155,7 +162,21 @@ typedef  uint8_t si8900_cfg;
  * get reading as a uint16_t with the lower 10 bits being the reading
  * between 0 and 1024 inclusive, upper bits are zero padding
  */
-#define GET_READING(packet)	((uint16_t)((packet & 0x0FFE) >> 1))
+#define GET_READING(packet)	((uint16_t)((packet & 0x07FE) >> 1))
+
+
+/*
+ * frame layout checks -- a full response is SI8900_FRAME_LEN bytes:
+ * CMD echo (11xxxxxx), Data Byte 1 (10xxxxxx), Data Byte 2 (0xxxxxx0)
+ * see the RECIEVE PACKETS description below for the bit layout
+ */
+#define SI8900_FRAME_LEN    3
+#define IS_CMD_BYTE(b)      (((b) & 0xC0) == 0xC0)
+#define IS_DATA1_BYTE(b)    (((b) & 0xC0) == 0x80)
+#define IS_DATA2_BYTE(b)    (((b) & 0x81) == 0x00)
+#define IS_FRAME(p)         (IS_CMD_BYTE((p)[0]) && IS_DATA1_BYTE((p)[1]) && \
+                             IS_DATA2_BYTE((p)[2]) && GET_INCH((p)[0]) == GET_INCH((p)[1]) && \
+                             GET_INCH((p)[1]) < SI8900_NUM_CH)
 
 
 /*
@@ -187,19 +208,23 @@ typedef struct si8900_reading{
 /*
  * TX/RX commands
  */
+#ifndef PC_
 uint8_t si8900_auto_baud(void);
 void si8900_send_cmd(si8900_cfg);
+#endif
 
 /*
  * Byte processing
  */
 si8900_reading si8900_get_reading(uint8_t*, uint8_t);
 si8900_reading si8900_get_reading_oversampled(uint8_t*, uint8_t, uint8_t);
+size_t si8900_decode_frames(const uint8_t*, size_t, si8900_reading*, size_t, size_t*);
 
 /*
  * internal functions
  */
 uint16_t bit_reverse(uint16_t);
+size_t si8900_sync_frame(const uint8_t*, size_t, size_t);
 
 /*
  * END: Function prototypes / declarations
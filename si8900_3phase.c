@@ -0,0 +1,257 @@
+/*
+ * si8900_3phase.c
+ * implementation file for si8900 three phase analytics.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_3phase.h" // includes "si8900_merge.h", "si8900_convert.h"
+
+#include <math.h>
+#include <string.h>
+
+#define SI8900_3PH_PI  3.14159265358979323846
+#define SI8900_3PH_RT3 1.73205080756887729353
+
+
+/*
+ *  name: si8900_3ph_wrap
+ *
+ *  desc: angle into (-pi, pi]
+ */
+static double si8900_3ph_wrap(double a)
+{
+    while (a > SI8900_3PH_PI)
+    {
+        a -= 2.0 * SI8900_3PH_PI;
+    }
+    while (a <= -SI8900_3PH_PI)
+    {
+        a += 2.0 * SI8900_3PH_PI;
+    }
+    return a;
+}
+
+
+/*
+ *  name: si8900_3ph_restart
+ *
+ *  desc: starts a new window at t0 with the current frequency
+ */
+static void si8900_3ph_restart(si8900_3ph* p, si8900_tstamp t0)
+{
+    p->t0 = t0;
+    p->period_ns = (si8900_tstamp)(1e9 / p->freq_hz + 0.5);
+    memset(p->acc, 0, sizeof(p->acc));
+}
+
+
+/*
+ *  name: si8900_3ph_close
+ *
+ *  desc: turns the window sums into a result, tracks the frequency
+ *
+ *  return value:
+ *      uint8_t: 1 when a result was published
+ */
+static uint8_t si8900_3ph_close(si8900_3ph* p)
+{
+    double re[3], im[3], r0, i0, r1, i1, r2, i2, angle, f;
+    const double ar = -0.5, ai = SI8900_3PH_RT3 / 2.0; // a = 1 /_120
+    uint8_t k;
+
+    for (k = 0; k < 3; k++)
+    {
+        const si8900_3ph_acc* a = &p->acc[k];
+        double n = a->n, m00, m01, m02, m11, m12, m22, det, ca, cb;
+
+        if (a->n < SI8900_3PH_MIN_READINGS)
+        {
+            p->have_prev = 0;
+            return 0;
+        }
+        // normal equations of x = dc + ca cos + cb sin, solved by Cramer's rule
+        // (symmetric, so only the cofactors needed for ca and cb)
+        m00 = n * a->scc - a->sc * a->sc;
+        m01 = n * a->scs - a->sc * a->ss;
+        m02 = a->sc * a->scs - a->ss * a->scc;
+        m11 = n * a->sss - a->ss * a->ss;
+        m12 = a->ss * a->scs - a->sc * a->sss;
+        m22 = a->scc * a->sss - a->scs * a->scs;
+        det = n * m22 + a->sc * m12 + a->ss * m02;
+        if (fabs(det) < 1e-12 * n * n * n)
+        {
+            p->have_prev = 0;
+            return 0;
+        }
+        ca = (a->sx * m12 + a->sxc * m11 - a->sxs * m01) / det;
+        cb = (a->sx * m02 - a->sxc * m01 + a->sxs * m00) / det;
+        // ca cos + cb sin = Re{(ca - j cb) e^(j th)}, 1/sqrt(2) for RMS
+        re[k] = ca / sqrt(2.0);
+        im[k] = -cb / sqrt(2.0);
+    }
+
+    r0 = (re[0] + re[1] + re[2]) / 3.0;
+    i0 = (im[0] + im[1] + im[2]) / 3.0;
+    // a Vb and a^2 Vc, a^2 = conj(a)
+    r1 = (re[0] + (ar * re[1] - ai * im[1]) + (ar * re[2] + ai * im[2])) / 3.0;
+    i1 = (im[0] + (ar * im[1] + ai * re[1]) + (ar * im[2] - ai * re[2])) / 3.0;
+    r2 = (re[0] + (ar * re[1] + ai * im[1]) + (ar * re[2] - ai * im[2])) / 3.0;
+    i2 = (im[0] + (ar * im[1] - ai * re[1]) + (ar * im[2] + ai * re[2])) / 3.0;
+
+    p->res.start = p->t0;
+    for (k = 0; k < 3; k++)
+    {
+        uint8_t j = (k + 1) % 3;
+        p->res.v_rms[k] = sqrt(re[k] * re[k] + im[k] * im[k]);
+        p->res.v_ll[k] = sqrt((re[k] - re[j]) * (re[k] - re[j]) + (im[k] - im[j]) * (im[k] - im[j]));
+        p->res.angle_deg[k] = si8900_3ph_wrap(atan2(im[k], re[k]) - atan2(im[0], re[0])) * 180.0 / SI8900_3PH_PI;
+    }
+    p->res.v0 = sqrt(r0 * r0 + i0 * i0);
+    p->res.v1 = sqrt(r1 * r1 + i1 * i1);
+    p->res.v2 = sqrt(r2 * r2 + i2 * i2);
+    p->res.unbal_neg_pct = (p->res.v1 > 0.0) ? 100.0 * p->res.v2 / p->res.v1 : 0.0;
+    p->res.unbal_zero_pct = (p->res.v1 > 0.0) ? 100.0 * p->res.v0 / p->res.v1 : 0.0;
+    p->res.freq_hz = p->freq_hz;
+
+    // the positive sequence turned by 2 pi (f * step - 1) since the last
+    // window, where step is the spacing of the window starts: the last
+    // window's length, not this one's
+    angle = atan2(i1, r1);
+    if (p->have_prev)
+    {
+        f = (si8900_3ph_wrap(angle - p->prev_angle) / (2.0 * SI8900_3PH_PI) + 1.0) * 1e9 / (double)p->prev_period_ns;
+        f = p->freq_hz + 0.5 * (f - p->freq_hz);
+        if (f < MAINS_FRQ - SI8900_3PH_FREQ_SPAN)
+        {
+            f = MAINS_FRQ - SI8900_3PH_FREQ_SPAN;
+        }
+        if (f > MAINS_FRQ + SI8900_3PH_FREQ_SPAN)
+        {
+            f = MAINS_FRQ + SI8900_3PH_FREQ_SPAN;
+        }
+        p->freq_hz = f;
+        p->res.freq_hz = f;
+    }
+    p->prev_angle = angle;
+    p->prev_period_ns = p->period_ns;
+    p->have_prev = 1;
+    p->cycles++;
+    return 1;
+}
+
+
+/*
+ *  name: si8900_3ph_init
+ *
+ *  desc: sets up the engine at the nominal mains frequency
+ *
+ *  args:
+ *      si8900_3ph* p               : engine
+ *      const uint16_t stream[3]    : merge streams carrying phase A, B, C
+ *      const si8900_conv_cal cal[3]: front end calibration per phase
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      const uint16_t streams[3] = {0 * SI8900_NUM_CH + 0, 1 * SI8900_NUM_CH + 0, 2 * SI8900_NUM_CH + 0};
+ *      const si8900_conv_cal cal[3] = {SI8900_CAL_MAINS, SI8900_CAL_MAINS, SI8900_CAL_MAINS};
+ *      si8900_3ph tp;
+ *      si8900_3ph_init(&tp, streams, cal);
+ */
+void si8900_3ph_init(si8900_3ph* p, const uint16_t stream[3], const si8900_conv_cal cal[3])
+{
+    uint8_t k;
+
+    memset(p, 0, sizeof(*p));
+    for (k = 0; k < 3; k++)
+    {
+        p->stream[k] = stream[k];
+        p->cal[k] = cal[k];
+        p->lsb[k] = si8900_lsb_volts(p->lsb_cmd[k]);
+    }
+    p->freq_hz = MAINS_FRQ;
+}
+
+
+/*
+ *  name: si8900_3ph_update
+ *
+ *  desc: feeds time ordered readings, readings of other streams are ignored
+ *
+ *  args:
+ *      si8900_3ph* p           : engine
+ *      const si8900_merged* in : readings, eg: from si8900_merge_pop
+ *      size_t n                : number of readings
+ *
+ *  return value:
+ *      uint32_t: cycles finished in this call, p->res holds the last one
+ *
+ *  example:
+ *      n = si8900_merge_pop(&m, batch, 4096);
+ *      if (si8900_3ph_update(&tp, batch, n))
+ *      {
+ *          log_unbalance(tp.res.unbal_neg_pct);
+ *      }
+ */
+uint32_t si8900_3ph_update(si8900_3ph* p, const si8900_merged* in, size_t n)
+{
+    uint32_t published = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        si8900_3ph_acc* a;
+        si8900_tstamp t;
+        double x, dt, th, c, sn;
+        uint8_t k;
+
+        for (k = 0; k < 3 && in[i].stream != p->stream[k]; k++);
+        if (k == 3)
+        {
+            continue;
+        }
+        t = (si8900_tstamp)((int64_t)in[i].tstamp + p->skew_ns[k]);
+        if (!p->started)
+        {
+            si8900_3ph_restart(p, t);
+            p->started = 1;
+        }
+        if (t >= p->t0 + p->period_ns)
+        {
+            published += si8900_3ph_close(p);
+            if (t >= p->t0 + 2 * p->period_ns)
+            {
+                // gap in the data, the angle history no longer holds
+                p->have_prev = 0;
+                si8900_3ph_restart(p, t);
+            }
+            else
+            {
+                si8900_3ph_restart(p, p->t0 + p->period_ns);
+            }
+        }
+
+        if (in[i].r.cmd_byte != p->lsb_cmd[k])
+        {
+            p->lsb_cmd[k] = in[i].r.cmd_byte;
+            p->lsb[k] = si8900_lsb_volts(p->lsb_cmd[k]);
+        }
+        x = in[i].r.reading * p->lsb[k] * p->cal[k].scale + p->cal[k].offset;
+        dt = (double)(int64_t)(t - p->t0);
+        th = 2.0 * SI8900_3PH_PI * p->freq_hz * dt * 1e-9;
+
+        c = cos(th);
+        sn = sin(th);
+        a = &p->acc[k];
+        a->sx += x;
+        a->sxc += x * c;
+        a->sxs += x * sn;
+        a->sc += c;
+        a->ss += sn;
+        a->scc += c * c;
+        a->sss += sn * sn;
+        a->scs += c * sn;
+        a->n++;
+    }
+    return published;
+}
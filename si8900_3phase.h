@@ -0,0 +1,119 @@
+/*
+ * si8900_3phase.h
+ * three phase voltage analytics from one si8900 per phase (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option.
+ *
+ *  Takes the time ordered output of si8900_merge, where the voltage
+ *  channel of each phase's si8900 is one stream. Each phase's fundamental
+ *  phasor is a least squares fit of dc + a cos + b sin over a one cycle
+ *  window, evaluated at the readings' own timestamps, so the three devices
+ *  do not need to sample at the same instants or rates -- the phasors all
+ *  refer to the shared time base. The fit stays exact when the window
+ *  does not hold a whole number of reading periods.
+ *
+ *  The devices' host clocks drift apart, so run each device's blocks
+ *  through si8900_sync_correct_block before si8900_merge_push_block; the
+ *  merged timestamps are then already on the reference clock. skew_ns is
+ *  only for a fixed extra delay of one phase (eg: a slower front end
+ *  filter) and is added to that phase's timestamps: for a phase whose
+ *  readings are stamped d ns late set skew_ns = -d. Do not put the
+ *  si8900_sync offset in it -- that offset drifts, and is device minus
+ *  reference time, the opposite sign.
+ *
+ *  Per reading only a sin/cos and a few multiply-adds are done; nothing
+ *  is buffered.
+ *
+ *  Once per cycle, from the A, B and C phasors (RMS, fundamental only):
+ *      line to line voltages   |Va - Vb|, |Vb - Vc|, |Vc - Va|
+ *      phase angles            B and C relative to A, -120 / +120 for ABC
+ *      sequence components     V0 = (Va + Vb + Vc) / 3
+ *                              V1 = (Va + a Vb + a^2 Vc) / 3
+ *                              V2 = (Va + a^2 Vb + a Vc) / 3, a = 1 /_120
+ *      unbalance               V2 / V1 and V0 / V1 in percent
+ *
+ *  The window follows the mains frequency: the positive sequence phasor
+ *  turns by (f - f_window) * 360 degrees between window starts, which
+ *  gives the frequency (half way smoothed) and the next window's length.
+ */
+
+#ifndef si8900_3phase_H_
+#define si8900_3phase_H_
+
+#ifndef PC_
+    #error "si8900_3phase is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_merge.h"   // includes "si8900_block.h", si8900_merged
+#include "si8900_convert.h" // si8900_conv_cal
+
+
+#define SI8900_3PH_MIN_READINGS 8   // per phase per cycle for a result
+#define SI8900_3PH_FREQ_SPAN    5.0 // Hz either side of MAINS_FRQ tracked
+
+
+/*
+ * PER CYCLE RESULT
+ */
+typedef struct si8900_3ph_res{
+    si8900_tstamp start;    // window start
+    double freq_hz;
+    double v_rms[3];        // A, B, C fundamental RMS volts
+    double v_ll[3];         // AB, BC, CA
+    double angle_deg[3];    // relative to A: 0, B, C
+    double v0, v1, v2;      // sequence magnitudes, RMS volts
+    double unbal_neg_pct;   // V2 / V1 * 100
+    double unbal_zero_pct;  // V0 / V1 * 100
+}si8900_3ph_res;
+
+
+/*
+ * PER PHASE WINDOW SUMS
+ */
+typedef struct si8900_3ph_acc{
+    double sx, sxc, sxs;    // sum x, x cos, x sin
+    double sc, ss;          // sum cos, sin
+    double scc, sss, scs;   // sum cos^2, sin^2, cos sin
+    uint32_t n;
+}si8900_3ph_acc;
+
+
+/*
+ * ENGINE
+ */
+typedef struct si8900_3ph{
+    uint16_t stream[3];         // merge stream of phase A, B, C
+    si8900_conv_cal cal[3];
+    int64_t skew_ns[3];         // fixed delay added to each phase's timestamps, 0 by default
+    si8900_cfg lsb_cmd[3];      // command byte 'lsb' was worked out for
+    double lsb[3];
+    double freq_hz;             // current window frequency
+    si8900_tstamp t0;           // current window start
+    si8900_tstamp period_ns;    // current window length
+    si8900_tstamp prev_period_ns; // last window's length, the step from its start to t0
+    uint8_t started;
+    uint8_t have_prev;
+    double prev_angle;          // positive sequence angle of the last window
+    uint32_t cycles;            // results published
+    si8900_3ph_acc acc[3];
+    si8900_3ph_res res;         // latest result
+}si8900_3ph;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_3ph_init(si8900_3ph*, const uint16_t[3], const si8900_conv_cal[3]);
+uint32_t si8900_3ph_update(si8900_3ph*, const si8900_merged*, size_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_3phase_H_ */
@@ -0,0 +1,163 @@
+/*
+ * si8900_block.c
+ * implementation file for si8900 structure-of-arrays sample blocks.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_block.h" // includes "si8900.h"
+
+
+/*
+ *  name: si8900_block_reset
+ *
+ *  desc: empties every channel row of a sample block
+ *
+ *  args:
+ *      si8900_block* blk : block to reset
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      static si8900_block blk;
+ *      si8900_block_reset(&blk);
+ */
+void si8900_block_reset(si8900_block* blk)
+{
+    uint8_t ch;
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        blk->count[ch] = 0;
+        blk->cmd_byte[ch] = 0;
+    }
+}
+
+
+/*
+ *  name: si8900_block_append
+ *
+ *  desc: scatters an array of si8900_reading structs into the channel
+ *        rows of a sample block. Stops at the first reading whose channel
+ *        row is full so the caller can flush the block and resume.
+ *        Failed readings (inch == FAILED) are skipped.
+ *
+ *  args:
+ *      si8900_block* blk           : block to append to
+ *      const si8900_reading* reads : readings to append
+ *      size_t n                    : number of entries in 'reads'
+ *
+ *  return value:
+ *      size_t: number of entries of 'reads' used up
+ *
+ *  example:
+ *      size_t used = si8900_block_append(&blk, readings, n);
+ *      if (used < n)
+ *      {
+ *          // block full, process it, reset and append readings + used
+ *      }
+ */
+size_t si8900_block_append(si8900_block* blk, const si8900_reading* reads, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+    {
+        uint8_t ch = reads[i].inch;
+        if (ch >= SI8900_NUM_CH)
+        {
+            continue; // failed read
+        }
+        if (blk->count[ch] >= SI8900_BLOCK_LEN)
+        {
+            break;
+        }
+        blk->reading[ch][blk->count[ch]++] = reads[i].reading;
+        blk->cmd_byte[ch] = reads[i].cmd_byte;
+    }
+    return i;
+}
+
+
+/*
+ *  name: si8900_decode_block
+ *
+ *  desc: same as si8900_decode_frames, but writes the readings straight
+ *        into the channel rows of a sample block. Stops when the row of
+ *        the next frame's channel is full, leaving that frame unconsumed.
+ *
+ *  args:
+ *      const uint8_t* in : raw bytes received from the si8900
+ *      size_t len        : number of bytes in 'in'
+ *      si8900_block* blk : block to append to
+ *      size_t* consumed  : set to the number of bytes of 'in' used up,
+ *                          may be NULL
+ *
+ *  return value:
+ *      size_t: number of frames decoded into the block
+ *
+ *  example:
+ *      size_t used;
+ *      si8900_decode_block(rx_buf, rx_len, &blk, &used);
+ *      // keep rx_buf[used .. rx_len-1] for next call
+ */
+size_t si8900_decode_block(const uint8_t* in, size_t len, si8900_block* blk, size_t* consumed)
+{
+    size_t pos = 0, count = 0;
+
+    for (;;)
+    {
+        uint8_t ch;
+        pos = si8900_sync_frame(in, len, pos);
+        if (pos + SI8900_FRAME_LEN > len)
+        {
+            break; // nothing but a partial frame left
+        }
+        ch = GET_INCH(in[pos + 1]);
+        if (blk->count[ch] >= SI8900_BLOCK_LEN)
+        {
+            break;
+        }
+        blk->reading[ch][blk->count[ch]++] = GET_READING(PACKET_JOIN(in[pos + 1], in[pos + 2]));
+        blk->cmd_byte[ch] = in[pos];
+        count++;
+        pos += SI8900_FRAME_LEN;
+    }
+
+    if (consumed)
+    {
+        *consumed = pos;
+    }
+    return count;
+}
+
+
+#ifdef SI8900_TSTAMP_
+/*
+ *  name: si8900_block_stamp
+ *
+ *  desc: fills the timestamps of a channel row from index 'first' up to
+ *        the current count with evenly spaced times
+ *
+ *  args:
+ *      si8900_block* blk : block to stamp
+ *      uint8_t ch        : channel row to stamp
+ *      uint16_t first    : first index to stamp
+ *      si8900_tstamp t0  : timestamp of reading[ch][first]
+ *      si8900_tstamp dt  : time between readings
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      uint16_t first = blk.count[0];
+ *      si8900_decode_block(rx_buf, rx_len, &blk, &used);
+ *      si8900_block_stamp(&blk, 0, first, rx_time, sample_period);
+ */
+void si8900_block_stamp(si8900_block* blk, uint8_t ch, uint16_t first, si8900_tstamp t0, si8900_tstamp dt)
+{
+    uint16_t i;
+    for (i = first; i < blk->count[ch]; i++)
+    {
+        blk->tstamp[ch][i] = t0;
+        t0 += dt;
+    }
+}
+#endif /* SI8900_TSTAMP_ */
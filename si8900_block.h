@@ -0,0 +1,97 @@
+/*
+ * si8900_block.h
+ * structure-of-arrays sample block for si8900 readings.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  A block keeps one row of uint16_t readings per input channel instead of
+ *  an array of si8900_reading structs, so per channel processing (RMS,
+ *  statistics, filters) runs over a dense, aligned array.
+ *
+ *  Optional values: -- define in build config
+ *      SI8900_BLOCK_LEN : readings per channel row. Must be a multiple of 32
+ *                         so every row starts on a cache line.
+ *                         defaults: 4096 for PC_, 32 otherwise
+ *      SI8900_TSTAMP_   : adds a timestamp row per channel
+ */
+
+#ifndef si8900_block_H_
+#define si8900_block_H_
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+#ifndef SI8900_BLOCK_LEN
+    #ifdef PC_
+        #define SI8900_BLOCK_LEN    4096
+    #else
+        #define SI8900_BLOCK_LEN    32
+    #endif
+#endif
+
+#if (SI8900_BLOCK_LEN % 32) != 0
+    #error "SI8900_BLOCK_LEN must be a multiple of 32."
+#endif
+
+
+/*
+ * alignment of the per channel rows
+ */
+#define SI8900_CACHE_LINE   64
+
+#if defined(__GNUC__) || defined(__clang__) || defined(__TI_COMPILER_VERSION__)
+    #define SI8900_ALIGNED(n)   __attribute__((aligned(n)))
+#else
+    #define SI8900_ALIGNED(n)
+#endif
+
+
+/*
+ * timestamp of a reading
+ *      PC_   : nanoseconds
+ *      other : free running timer ticks
+ */
+#ifdef PC_
+typedef uint64_t si8900_tstamp;
+#else
+typedef uint32_t si8900_tstamp;
+#endif
+
+
+/*
+ * SAMPLE BLOCK
+ *
+ * reading[ch][0 .. count[ch]-1] : 10 bit readings of channel ch
+ * tstamp[ch][0 .. count[ch]-1]  : matching timestamps (SI8900_TSTAMP_ only)
+ * cmd_byte[ch]                  : last command echo seen on ch, carries the
+ *                                 PGA/REF settings needed for conversion
+ */
+typedef struct si8900_block{
+    uint16_t reading[SI8900_NUM_CH][SI8900_BLOCK_LEN] SI8900_ALIGNED(SI8900_CACHE_LINE);
+#ifdef SI8900_TSTAMP_
+    si8900_tstamp tstamp[SI8900_NUM_CH][SI8900_BLOCK_LEN] SI8900_ALIGNED(SI8900_CACHE_LINE);
+#endif
+    uint16_t count[SI8900_NUM_CH];
+    si8900_cfg cmd_byte[SI8900_NUM_CH];
+}si8900_block;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_block_reset(si8900_block*);
+size_t si8900_block_append(si8900_block*, const si8900_reading*, size_t);
+size_t si8900_decode_block(const uint8_t*, size_t, si8900_block*, size_t*);
+#ifdef SI8900_TSTAMP_
+void si8900_block_stamp(si8900_block*, uint8_t, uint16_t, si8900_tstamp, si8900_tstamp);
+#endif
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_block_H_ */
@@ -0,0 +1,200 @@
+/*
+ * si8900_convert.c
+ * implementation file for batch conversion of si8900 readings to voltages.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_convert.h" // includes "si8900_block.h"
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+
+/*
+ *  name: si8900_lsb_volts
+ *
+ *  desc: volts at the input pin represented by one count of a reading
+ *        taken with the given command byte
+ *
+ *  args:
+ *      si8900_cfg cmd_byte : command byte (or its echo) used for the reading
+ *
+ *  return value:
+ *      double: volts per count
+ *
+ *  example:
+ *      double lsb = si8900_lsb_volts(GP_SINGLE_READ_0);
+ */
+double si8900_lsb_volts(si8900_cfg cmd_byte)
+{
+    double full_scale = (cmd_byte & REF_1) ? SI8900_VREF : SI8900_VCC;
+    if (!(cmd_byte & PGA_1))
+    {
+        full_scale *= 2.0; // gain of .5
+    }
+    return full_scale / SI8900_RES;
+}
+
+
+/*
+ *  name: si8900_convert_f32
+ *
+ *  desc: converts an array of readings to volts as float
+ *
+ *  args:
+ *      const uint16_t* in        : readings to convert
+ *      float* out                : array of n entries to write volts into
+ *      size_t n                  : number of readings
+ *      si8900_cfg cmd_byte       : command byte the readings were taken with
+ *      const si8900_conv_cal* cal: channel calibration
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_conv_cal cal = SI8900_CAL_MAINS;
+ *      si8900_convert_f32(blk.reading[0], volts, blk.count[0], blk.cmd_byte[0], &cal);
+ */
+void si8900_convert_f32(const uint16_t* in, float* out, size_t n, si8900_cfg cmd_byte, const si8900_conv_cal* cal)
+{
+    const float k = (float)(si8900_lsb_volts(cmd_byte) * cal->scale);
+    const float ofs = (float)cal->offset;
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256 vk = _mm256_set1_ps(k);
+    const __m256 vofs = _mm256_set1_ps(ofs);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i raw = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m256 v = _mm256_cvtepi32_ps(raw);
+    #ifdef __FMA__
+        v = _mm256_fmadd_ps(v, vk, vofs);
+    #else
+        v = _mm256_add_ps(_mm256_mul_ps(v, vk), vofs);
+    #endif
+        _mm256_storeu_ps(out + i, v);
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        out[i] = (float)in[i] * k + ofs;
+    }
+}
+
+
+/*
+ *  name: si8900_convert_f64
+ *
+ *  desc: converts an array of readings to volts as double
+ *
+ *  args:
+ *      const uint16_t* in        : readings to convert
+ *      double* out               : array of n entries to write volts into
+ *      size_t n                  : number of readings
+ *      si8900_cfg cmd_byte       : command byte the readings were taken with
+ *      const si8900_conv_cal* cal: channel calibration
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_conv_cal cal = SI8900_CAL_PIN;
+ *      si8900_convert_f64(readings, volts, n, GP_SINGLE_READ_1, &cal);
+ */
+void si8900_convert_f64(const uint16_t* in, double* out, size_t n, si8900_cfg cmd_byte, const si8900_conv_cal* cal)
+{
+    const double k = si8900_lsb_volts(cmd_byte) * cal->scale;
+    const double ofs = cal->offset;
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256d vk = _mm256_set1_pd(k);
+    const __m256d vofs = _mm256_set1_pd(ofs);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i raw = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(raw));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(raw, 1));
+    #ifdef __FMA__
+        lo = _mm256_fmadd_pd(lo, vk, vofs);
+        hi = _mm256_fmadd_pd(hi, vk, vofs);
+    #else
+        lo = _mm256_add_pd(_mm256_mul_pd(lo, vk), vofs);
+        hi = _mm256_add_pd(_mm256_mul_pd(hi, vk), vofs);
+    #endif
+        _mm256_storeu_pd(out + i, lo);
+        _mm256_storeu_pd(out + i + 4, hi);
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        out[i] = (double)in[i] * k + ofs;
+    }
+}
+
+
+/*
+ *  name: si8900_convert_block_f32
+ *
+ *  desc: converts every channel row of a sample block to volts as float,
+ *        using the command byte recorded for each channel
+ *
+ *  args:
+ *      const si8900_block* blk       : block to convert
+ *      float* out[SI8900_NUM_CH]     : per channel output arrays of at least
+ *                                      blk->count[ch] entries, NULL to skip a channel
+ *      const si8900_conv_cal cal[]   : per channel calibration
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      float* out[SI8900_NUM_CH] = {v_mains, NULL, NULL};
+ *      si8900_conv_cal cal[SI8900_NUM_CH] = {SI8900_CAL_MAINS, SI8900_CAL_PIN, SI8900_CAL_PIN};
+ *      si8900_convert_block_f32(&blk, out, cal);
+ */
+void si8900_convert_block_f32(const si8900_block* blk, float* out[SI8900_NUM_CH], const si8900_conv_cal cal[SI8900_NUM_CH])
+{
+    uint8_t ch;
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        if (out[ch])
+        {
+            si8900_convert_f32(blk->reading[ch], out[ch], blk->count[ch], blk->cmd_byte[ch], &cal[ch]);
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_convert_block_f64
+ *
+ *  desc: converts every channel row of a sample block to volts as double,
+ *        using the command byte recorded for each channel
+ *
+ *  args:
+ *      const si8900_block* blk       : block to convert
+ *      double* out[SI8900_NUM_CH]    : per channel output arrays of at least
+ *                                      blk->count[ch] entries, NULL to skip a channel
+ *      const si8900_conv_cal cal[]   : per channel calibration
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      see si8900_convert_block_f32
+ */
+void si8900_convert_block_f64(const si8900_block* blk, double* out[SI8900_NUM_CH], const si8900_conv_cal cal[SI8900_NUM_CH])
+{
+    uint8_t ch;
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        if (out[ch])
+        {
+            si8900_convert_f64(blk->reading[ch], out[ch], blk->count[ch], blk->cmd_byte[ch], &cal[ch]);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * si8900_convert.h
+ * batch conversion of si8900 readings to voltages.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  The volts per count of a reading depend on the command byte it was
+ *  taken with:
+ *      REF_0 : full scale is SI8900_VCC (VDD)
+ *      REF_1 : full scale is SI8900_VREF (external ref pin)
+ *      PGA_0 : gain of .5, doubles the input range
+ *      PGA_1 : gain of 1
+ *
+ *  On top of that each channel gets a calibration of
+ *      volts = reading * lsb(cmd_byte) * scale + offset
+ *  where scale undoes the analogue front end (eg: the mains divider).
+ *
+ *  AVX2 (and FMA when present) is used automatically when the compiler
+ *  targets it (eg: -mavx2 -mfma), a portable loop is used otherwise.
+ */
+
+#ifndef si8900_convert_H_
+#define si8900_convert_H_
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h"
+
+
+/*
+ * per channel calibration
+ */
+typedef struct si8900_conv_cal{
+    double scale;   // front end ratio, volts at the sensor per volt at the pin
+    double offset;  // volts added after scaling
+}si8900_conv_cal;
+
+
+/*
+ * general purpose calibrations
+ *      SI8900_CAL_PIN   : volts at the si8900 input pin
+ *      SI8900_CAL_MAINS : mains volts, matches MAINS_CONV_RATE for REF_0 | PGA_1
+ */
+#define SI8900_CAL_PIN      {1.0, 0.0}
+#define SI8900_CAL_MAINS    {(MAINS_PEAK / SI8900_VREF), 0.0}
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+double si8900_lsb_volts(si8900_cfg);
+void si8900_convert_f32(const uint16_t*, float*, size_t, si8900_cfg, const si8900_conv_cal*);
+void si8900_convert_f64(const uint16_t*, double*, size_t, si8900_cfg, const si8900_conv_cal*);
+void si8900_convert_block_f32(const si8900_block*, float* [SI8900_NUM_CH], const si8900_conv_cal[SI8900_NUM_CH]);
+void si8900_convert_block_f64(const si8900_block*, double* [SI8900_NUM_CH], const si8900_conv_cal[SI8900_NUM_CH]);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_convert_H_ */
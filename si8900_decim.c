@@ -0,0 +1,341 @@
+/*
+ * si8900_decim.c
+ * implementation file for si8900 decimation stages.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_decim.h" // includes "si8900_block.h"
+
+#ifdef PC_
+    #include <math.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #ifdef __AVX2__
+        #include <immintrin.h>
+    #endif
+#endif
+
+
+/*
+ *  name: si8900_cic_init
+ *
+ *  desc: sets up a CIC decimator
+ *
+ *  args:
+ *      si8900_cic* c  : decimator to set up
+ *      uint8_t order  : number of integrator / comb pairs, 1 to SI8900_CIC_MAX_ORDER
+ *      uint16_t ratio : decimation ratio, >= 1
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a bad order or when the
+ *      gain would not fit 32 bits on 10 bit readings
+ *
+ *  example:
+ *      si8900_cic cic[SI8900_NUM_CH];
+ *      si8900_cic_init(&cic[0], 3, 16); // 16 kHz stream -> 1 kHz
+ */
+uint8_t si8900_cic_init(si8900_cic* c, uint8_t order, uint16_t ratio)
+{
+    uint32_t gain = 1;
+    uint8_t s;
+
+    if (order < 1 || order > SI8900_CIC_MAX_ORDER || ratio < 1)
+    {
+        return FAILED;
+    }
+    for (s = 0; s < order; s++)
+    {
+        if (gain > (0xFFFFFFFFUL / SI8900_RES) / ratio)
+        {
+            return FAILED;
+        }
+        gain *= ratio;
+    }
+
+    c->order = order;
+    c->ratio = ratio;
+    c->phase = 0;
+    c->gain = gain;
+    for (s = 0; s < SI8900_CIC_MAX_ORDER; s++)
+    {
+        c->integ[s] = 0;
+        c->comb[s] = 0;
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_cic_process
+ *
+ *  desc: decimates an array of readings in place
+ *
+ *  args:
+ *      si8900_cic* c  : decimator
+ *      uint16_t* buf  : readings in, decimated readings out from buf[0]
+ *      size_t n       : readings in 'buf'
+ *
+ *  return value:
+ *      size_t: decimated readings written to the front of 'buf'
+ *
+ *  example:
+ *      m = si8900_cic_process(&cic[0], readings, n);
+ */
+size_t si8900_cic_process(si8900_cic* c, uint16_t* buf, size_t n)
+{
+    size_t i, out = 0;
+    uint8_t s;
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t y = buf[i];
+        for (s = 0; s < c->order; s++)
+        {
+            c->integ[s] += y;
+            y = c->integ[s];
+        }
+        if (++c->phase < c->ratio)
+        {
+            continue;
+        }
+        c->phase = 0;
+        for (s = 0; s < c->order; s++)
+        {
+            uint32_t prev = c->comb[s];
+            c->comb[s] = y;
+            y -= prev;
+        }
+        buf[out++] = (uint16_t)((y + c->gain / 2) / c->gain);
+    }
+    return out;
+}
+
+
+/*
+ *  name: si8900_cic_block
+ *
+ *  desc: decimates every channel row of a sample block in place and
+ *        shortens the row counts to match. With SI8900_TSTAMP_ the
+ *        timestamp rows are decimated too, each output getting the time
+ *        of the last input reading that went into it.
+ *
+ *  args:
+ *      si8900_cic c[SI8900_NUM_CH] : one decimator per channel
+ *      si8900_block* blk           : block to decimate
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_decode_block(rx_buf, rx_len, &blk, &used);
+ *      si8900_cic_block(cic, &blk);
+ */
+void si8900_cic_block(si8900_cic c[SI8900_NUM_CH], si8900_block* blk)
+{
+    uint8_t ch;
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+#ifdef SI8900_TSTAMP_
+        // an output is due on the input that brings phase up to ratio
+        uint32_t src = (uint32_t)c[ch].ratio - 1 - c[ch].phase;
+        uint16_t k;
+#endif
+        blk->count[ch] = (uint16_t)si8900_cic_process(&c[ch], blk->reading[ch], blk->count[ch]);
+#ifdef SI8900_TSTAMP_
+        // each output takes the time of the last input it saw, src >= k
+        for (k = 0; k < blk->count[ch]; k++, src += c[ch].ratio)
+        {
+            blk->tstamp[ch][k] = blk->tstamp[ch][src];
+        }
+#endif
+    }
+}
+
+
+#ifdef PC_
+/*
+ *  name: si8900_fir_lowpass
+ *
+ *  desc: designs blackman windowed sinc lowpass taps with unity DC gain
+ *
+ *  args:
+ *      float* taps     : n_taps coefficients out
+ *      uint32_t n_taps : number of taps, odd gives a whole sample delay
+ *      double cutoff   : cutoff as a fraction of the input rate,
+ *                        eg: 0.4 / ratio
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      float taps[127];
+ *      si8900_fir_lowpass(taps, 127, 0.4 / 10);
+ */
+void si8900_fir_lowpass(float* taps, uint32_t n_taps, double cutoff)
+{
+    const double pi = 3.14159265358979323846;
+    double mid = (n_taps - 1) / 2.0, sum = 0.0;
+    uint32_t i;
+
+    for (i = 0; i < n_taps; i++)
+    {
+        double t = i - mid;
+        double a = (n_taps > 1) ? 2.0 * pi * i / (n_taps - 1) : 0.0;
+        double w = 0.42 - 0.5 * cos(a) + 0.08 * cos(2.0 * a);
+        double h = (t == 0.0) ? 2.0 * cutoff : sin(2.0 * pi * cutoff * t) / (pi * t);
+        taps[i] = (float)(h * w);
+        sum += h * w;
+    }
+    for (i = 0; i < n_taps; i++)
+    {
+        taps[i] = (float)(taps[i] / sum);
+    }
+}
+
+
+/*
+ *  name: si8900_fir_init
+ *
+ *  desc: sets up a decimating FIR, the history starts at zero
+ *
+ *  args:
+ *      si8900_fir* f      : decimator to set up
+ *      const float* taps  : filter coefficients
+ *      uint32_t n_taps    : number of coefficients
+ *      uint32_t ratio     : decimation ratio, >= 1
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on bad arguments or out of memory
+ *
+ *  example:
+ *      si8900_fir fir;
+ *      si8900_fir_init(&fir, taps, 127, 10);
+ */
+uint8_t si8900_fir_init(si8900_fir* f, const float* taps, uint32_t n_taps, uint32_t ratio)
+{
+    uint32_t i;
+
+    f->taps_rev = NULL;
+    f->line = NULL;
+    if (!n_taps || !ratio)
+    {
+        return FAILED;
+    }
+    f->taps_rev = (float*)malloc(n_taps * sizeof(float));
+    f->line = (float*)calloc(n_taps - 1 + SI8900_FIR_CHUNK, sizeof(float));
+    if (!f->taps_rev || !f->line)
+    {
+        si8900_fir_free(f);
+        return FAILED;
+    }
+    for (i = 0; i < n_taps; i++)
+    {
+        f->taps_rev[i] = taps[n_taps - 1 - i];
+    }
+    f->n_taps = n_taps;
+    f->ratio = ratio;
+    f->phase = ratio - 1; // first output lands on the ratio-th input
+    return 0;
+}
+
+
+/*
+ *  name: si8900_fir_free
+ *
+ *  desc: releases a decimating FIR
+ *
+ *  args:
+ *      si8900_fir* f : decimator
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_fir_free(&fir);
+ */
+void si8900_fir_free(si8900_fir* f)
+{
+    free(f->taps_rev);
+    free(f->line);
+    f->taps_rev = NULL;
+    f->line = NULL;
+}
+
+
+/*
+ *  name: si8900_fir_dot
+ *
+ *  desc: dot product of n taps with n inputs
+ */
+static float si8900_fir_dot(const float* h, const float* x, uint32_t n)
+{
+    uint32_t i = 0;
+    float acc = 0.0f;
+#ifdef __AVX2__
+    __m256 v0 = _mm256_setzero_ps(), v1 = _mm256_setzero_ps();
+    float lanes[8];
+    for (; i + 16 <= n; i += 16)
+    {
+    #ifdef __FMA__
+        v0 = _mm256_fmadd_ps(_mm256_loadu_ps(h + i), _mm256_loadu_ps(x + i), v0);
+        v1 = _mm256_fmadd_ps(_mm256_loadu_ps(h + i + 8), _mm256_loadu_ps(x + i + 8), v1);
+    #else
+        v0 = _mm256_add_ps(v0, _mm256_mul_ps(_mm256_loadu_ps(h + i), _mm256_loadu_ps(x + i)));
+        v1 = _mm256_add_ps(v1, _mm256_mul_ps(_mm256_loadu_ps(h + i + 8), _mm256_loadu_ps(x + i + 8)));
+    #endif
+    }
+    _mm256_storeu_ps(lanes, _mm256_add_ps(v0, v1));
+    acc = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+#endif
+    for (; i < n; i++)
+    {
+        acc += h[i] * x[i];
+    }
+    return acc;
+}
+
+
+/*
+ *  name: si8900_fir_process
+ *
+ *  desc: filters and decimates an array in place
+ *
+ *  args:
+ *      si8900_fir* f : decimator
+ *      float* buf    : inputs in, decimated outputs out from buf[0]
+ *      size_t n      : inputs in 'buf'
+ *
+ *  return value:
+ *      size_t: outputs written to the front of 'buf'
+ *
+ *  example:
+ *      si8900_convert_f32(blk.reading[0], volts, blk.count[0], blk.cmd_byte[0], &cal);
+ *      m = si8900_fir_process(&fir, volts, blk.count[0]);
+ */
+size_t si8900_fir_process(si8900_fir* f, float* buf, size_t n)
+{
+    uint32_t hist = f->n_taps - 1;
+    size_t done = 0, out = 0;
+
+    while (done < n)
+    {
+        size_t chunk = n - done, i;
+        if (chunk > SI8900_FIR_CHUNK)
+        {
+            chunk = SI8900_FIR_CHUNK;
+        }
+        // stage the chunk behind the history, outputs never overtake the reads
+        memcpy(f->line + hist, buf + done, chunk * sizeof(float));
+
+        for (i = f->phase; i < chunk; i += f->ratio)
+        {
+            // output aligned with input i sees inputs i - n_taps + 1 .. i
+            buf[out++] = si8900_fir_dot(f->taps_rev, f->line + i, f->n_taps);
+        }
+        f->phase = (uint32_t)(i - chunk);
+
+        memmove(f->line, f->line + chunk, hist * sizeof(float));
+        done += chunk;
+    }
+    return out;
+}
+#endif /* PC_ */
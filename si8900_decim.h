@@ -0,0 +1,82 @@
+/*
+ * si8900_decim.h
+ * anti-aliased decimation stages for stream mode si8900 readings.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  CIC (all builds):
+ *      integer only cascaded integrator-comb decimator of order 1 to
+ *      SI8900_CIC_MAX_ORDER and ratio R, differential delay 1. Runs on
+ *      uint16_t reading arrays or sample block rows in place and outputs
+ *      readings scaled back to the input range. Integrators wrap modulo
+ *      2^32, which is exact as long as order * log2(R) + 10 <= 32.
+ *
+ *  Polyphase FIR (PC_ builds only):
+ *      decimating FIR over float arrays (eg: from si8900_convert_f32) that
+ *      only computes every R-th output -- each output sees the input
+ *      through one phase alignment of the taps, so no work is spent on
+ *      dropped outputs. Taps are user supplied or designed with
+ *      si8900_fir_lowpass. Dot products use AVX2 / FMA when targeted.
+ *      Arrays are processed in place.
+ */
+
+#ifndef si8900_decim_H_
+#define si8900_decim_H_
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h"
+
+
+#define SI8900_CIC_MAX_ORDER    4
+
+
+/*
+ * CIC DECIMATOR STATE
+ */
+typedef struct si8900_cic{
+    uint8_t order;
+    uint16_t ratio;
+    uint16_t phase;                         // inputs since the last output
+    uint32_t gain;                          // ratio ^ order
+    uint32_t integ[SI8900_CIC_MAX_ORDER];
+    uint32_t comb[SI8900_CIC_MAX_ORDER];
+}si8900_cic;
+
+
+#ifdef PC_
+/*
+ * FIR DECIMATOR STATE
+ */
+#define SI8900_FIR_CHUNK    4096    // inputs staged per pass
+
+typedef struct si8900_fir{
+    uint32_t n_taps;
+    uint32_t ratio;
+    uint32_t phase;         // inputs to skip before the next output
+    float* taps_rev;        // taps in reverse order
+    float* line;            // n_taps - 1 history + SI8900_FIR_CHUNK inputs
+}si8900_fir;
+#endif
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_cic_init(si8900_cic*, uint8_t, uint16_t);
+size_t si8900_cic_process(si8900_cic*, uint16_t*, size_t);
+void si8900_cic_block(si8900_cic[SI8900_NUM_CH], si8900_block*);
+#ifdef PC_
+void si8900_fir_lowpass(float*, uint32_t, double);
+uint8_t si8900_fir_init(si8900_fir*, const float*, uint32_t, uint32_t);
+void si8900_fir_free(si8900_fir*);
+size_t si8900_fir_process(si8900_fir*, float*, size_t);
+#endif
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_decim_H_ */
@@ -0,0 +1,296 @@
+/*
+ * si8900_event.c
+ * implementation file for the si8900 sag/swell/interruption detector.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_event.h" // includes "si8900.h"
+
+
+#define SI8900_EVENT_DC_SHIFT   10
+
+
+/*
+ *  name: si8900_isqrt32
+ *
+ *  desc: integer square root, floor(sqrt(v))
+ */
+static uint16_t si8900_isqrt32(uint32_t v)
+{
+    uint32_t root = 0, bit = 1UL << 30;
+    while (bit > v)
+    {
+        bit >>= 2;
+    }
+    while (bit)
+    {
+        if (v >= root + bit)
+        {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint16_t)root;
+}
+
+
+/*
+ *  name: si8900_event_thr
+ *
+ *  desc: sum of squares over the window of a percentage of nominal RMS
+ */
+static uint32_t si8900_event_thr(uint16_t nominal, uint16_t pct, uint16_t win_len)
+{
+    uint32_t rms = (uint32_t)nominal * pct / 100;
+    return rms * rms * win_len;
+}
+
+
+/*
+ *  name: si8900_event_init
+ *
+ *  desc: sets up an event detector for one channel
+ *
+ *  args:
+ *      si8900_event* e      : detector to set up
+ *      uint16_t half_cycle  : readings per mains half cycle
+ *                             (clamped to SI8900_EVENT_WIN_MAX)
+ *      uint16_t nominal_rms : nominal RMS in reading counts,
+ *                             eg: MAINS_RMS over the channel's volts per count
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      static si8900_event ev;
+ *      si8900_event_init(&ev, 30, 214); // 3 kHz at 50 Hz, 230 V nominal
+ */
+void si8900_event_init(si8900_event* e, uint16_t half_cycle, uint16_t nominal_rms)
+{
+    uint16_t i;
+
+    if (half_cycle > SI8900_EVENT_WIN_MAX)
+    {
+        half_cycle = SI8900_EVENT_WIN_MAX;
+    }
+    if (half_cycle == 0)
+    {
+        half_cycle = 1;
+    }
+    e->dc_q8 = (int32_t)(SI8900_RES / 2) << 8;
+    for (i = 0; i < SI8900_EVENT_WIN_MAX; i++)
+    {
+        e->win[i] = 0;
+    }
+    for (i = 0; i < SI8900_EVENT_RING; i++)
+    {
+        e->ring[i] = 0;
+    }
+    e->win_len = half_cycle;
+    e->win_pos = 0;
+    e->win_fill = 0;
+    e->sum_sq = 0;
+    e->thr_interrupt = si8900_event_thr(nominal_rms, SI8900_INTERRUPT_PCT, half_cycle);
+    e->thr_sag = si8900_event_thr(nominal_rms, SI8900_SAG_PCT, half_cycle);
+    e->thr_swell = si8900_event_thr(nominal_rms, SI8900_SWELL_PCT, half_cycle);
+    e->thr_sag_end = si8900_event_thr(nominal_rms, SI8900_SAG_PCT + SI8900_EVENT_HYST_PCT, half_cycle);
+    e->thr_swell_end = si8900_event_thr(nominal_rms, SI8900_SWELL_PCT - SI8900_EVENT_HYST_PCT, half_cycle);
+
+    e->index = 0;
+    e->state = SI8900_EVENT_NONE;
+    e->cap = NULL;
+    e->cap_live = 0;
+    e->rec_head = 0;
+    e->rec_used = 0;
+    e->rec_done = 0;
+    e->dropped = 0;
+}
+
+
+/*
+ *  name: si8900_event_update
+ *
+ *  desc: feeds one reading to the detector
+ *
+ *  args:
+ *      si8900_event* e  : detector
+ *      uint16_t reading : next reading of the watched channel
+ *
+ *  return value:
+ *      uint8_t: SI8900_EVENT_x type of an event that started on this
+ *               reading, SI8900_EVENT_NONE otherwise
+ *
+ *  example:
+ *      if (reading.inch == 0 && si8900_event_update(&ev, reading.reading))
+ *      {
+ *          led_on();
+ *      }
+ */
+uint8_t si8900_event_update(si8900_event* e, uint16_t reading)
+{
+    int32_t x_q8 = (int32_t)reading << 8;
+    int16_t ac;
+    uint8_t started = SI8900_EVENT_NONE;
+    uint8_t level;
+
+    // half cycle sliding RMS
+    e->dc_q8 += (x_q8 - e->dc_q8) >> SI8900_EVENT_DC_SHIFT;
+    ac = (int16_t)((x_q8 - e->dc_q8) >> 8);
+    e->sum_sq -= (uint32_t)((int32_t)e->win[e->win_pos] * e->win[e->win_pos]);
+    e->sum_sq += (uint32_t)((int32_t)ac * ac);
+    e->win[e->win_pos] = ac;
+    if (++e->win_pos >= e->win_len)
+    {
+        e->win_pos = 0;
+    }
+
+    // capture in progress: one pre-trigger copy and one post-trigger reading
+    if (e->cap)
+    {
+        if (e->pre_done < SI8900_EVENT_PRE)
+        {
+            uint32_t src = e->cap->start - SI8900_EVENT_PRE + e->pre_done;
+            e->cap->wave[e->pre_done++] = e->ring[src & (SI8900_EVENT_RING - 1)];
+        }
+        if (e->post_done < SI8900_EVENT_POST)
+        {
+            e->cap->wave[SI8900_EVENT_PRE + e->post_done++] = reading;
+        }
+    }
+
+    e->ring[e->index & (SI8900_EVENT_RING - 1)] = reading;
+
+    if (e->win_fill < e->win_len)
+    {
+        e->win_fill++;
+        e->index++;
+        return SI8900_EVENT_NONE;
+    }
+
+    if (e->sum_sq < e->thr_interrupt)
+    {
+        level = SI8900_EVENT_INTERRUPT;
+    }
+    else if (e->sum_sq < e->thr_sag)
+    {
+        level = SI8900_EVENT_SAG;
+    }
+    else if (e->sum_sq > e->thr_swell)
+    {
+        level = SI8900_EVENT_SWELL;
+    }
+    else
+    {
+        level = SI8900_EVENT_NONE;
+    }
+
+    if (e->state == SI8900_EVENT_NONE)
+    {
+        if (level != SI8900_EVENT_NONE)
+        {
+            e->state = level;
+            e->extreme_sq = e->sum_sq;
+            started = level;
+            // the last event's capture may still be filling its post-trigger part
+            if (e->cap == NULL && e->rec_used < SI8900_EVENT_RECS)
+            {
+                e->cap = &e->recs[(e->rec_head + e->rec_used) % SI8900_EVENT_RECS];
+                e->cap_live = 1;
+                e->rec_used++;
+                e->cap->type = level;
+                e->cap->start = e->index;
+                e->cap->duration = 0;
+                e->pre_done = 0;
+                e->post_done = 1;
+                e->cap->wave[SI8900_EVENT_PRE] = reading;
+            }
+            else
+            {
+                e->dropped++;
+            }
+        }
+    }
+    else
+    {
+        uint8_t ended;
+        if (e->state == SI8900_EVENT_SWELL)
+        {
+            ended = (e->sum_sq < e->thr_swell_end);
+            if (e->sum_sq > e->extreme_sq)
+            {
+                e->extreme_sq = e->sum_sq;
+            }
+        }
+        else
+        {
+            ended = (e->sum_sq > e->thr_sag_end) && (e->sum_sq < e->thr_swell);
+            if (e->sum_sq < e->extreme_sq)
+            {
+                e->extreme_sq = e->sum_sq;
+            }
+            if (level == SI8900_EVENT_INTERRUPT)
+            {
+                e->state = SI8900_EVENT_INTERRUPT; // sag got worse
+            }
+        }
+        if (ended)
+        {
+            if (e->cap_live)
+            {
+                e->cap->type = e->state;
+                e->cap->duration = e->index - e->cap->start;
+                e->cap->extreme_rms = si8900_isqrt32(e->extreme_sq / e->win_len);
+                e->cap_live = 0;
+            }
+            e->state = SI8900_EVENT_NONE;
+        }
+    }
+
+    // record is ready once the event ended and the capture is full
+    if (e->cap && !e->cap_live &&
+        e->pre_done >= SI8900_EVENT_PRE && e->post_done >= SI8900_EVENT_POST)
+    {
+        e->cap = NULL;
+        e->rec_done++;
+    }
+
+    e->index++;
+    return started;
+}
+
+
+/*
+ *  name: si8900_event_read
+ *
+ *  desc: takes the oldest finished event record off the queue
+ *
+ *  args:
+ *      si8900_event* e        : detector
+ *      si8900_event_rec* out  : record copied out
+ *
+ *  return value:
+ *      uint8_t with value 0 when a record was copied, FAILED when none is ready
+ *
+ *  example:
+ *      si8900_event_rec rec;
+ *      while (!si8900_event_read(&ev, &rec))
+ *      {
+ *          log_event(&rec);
+ *      }
+ */
+uint8_t si8900_event_read(si8900_event* e, si8900_event_rec* out)
+{
+    if (!e->rec_done)
+    {
+        return FAILED;
+    }
+    *out = e->recs[e->rec_head];
+    e->rec_head = (uint8_t)((e->rec_head + 1) % SI8900_EVENT_RECS);
+    e->rec_used--;
+    e->rec_done--;
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * si8900_event.h
+ * voltage sag/swell/interruption detector with pre-trigger capture.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Integer only, constant time per reading.
+ *
+ *  The RMS of the last half cycle is kept as a sliding sum of squares and
+ *  compared (squared) against thresholds relative to the nominal RMS:
+ *      interruption : below SI8900_INTERRUPT_PCT % of nominal
+ *      sag          : below SI8900_SAG_PCT % of nominal
+ *      swell        : above SI8900_SWELL_PCT % of nominal
+ *  An event ends once the RMS is back inside the limits by SI8900_EVENT_HYST_PCT %.
+ *
+ *  Raw readings go through a SI8900_EVENT_RING sized circular buffer. On a
+ *  trigger SI8900_EVENT_PRE readings before and SI8900_EVENT_POST readings
+ *  after it are frozen into a free event record. The pre-trigger readings
+ *  are copied out of the ring one per incoming reading, which always wins
+ *  the race against the writer as the ring is longer than the pre-trigger
+ *  depth, so acquisition never stops. An event that starts while the
+ *  previous one's capture is still filling gets no record (see dropped).
+ *
+ *  Optional values: -- define in build config
+ *      SI8900_EVENT_RING    : raw reading ring, power of 2 > SI8900_EVENT_PRE (default 128)
+ *      SI8900_EVENT_PRE     : readings kept before a trigger (default 64)
+ *      SI8900_EVENT_POST    : readings kept from the trigger on (default 64)
+ *      SI8900_EVENT_RECS    : event records queued for the application (default 2)
+ *      SI8900_EVENT_WIN_MAX : longest half cycle in readings (default 128)
+ */
+
+#ifndef si8900_event_H_
+#define si8900_event_H_
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+#ifndef SI8900_EVENT_RING
+    #define SI8900_EVENT_RING       128
+#endif
+#ifndef SI8900_EVENT_PRE
+    #define SI8900_EVENT_PRE        64
+#endif
+#ifndef SI8900_EVENT_POST
+    #define SI8900_EVENT_POST       64
+#endif
+#ifndef SI8900_EVENT_RECS
+    #define SI8900_EVENT_RECS       2
+#endif
+#ifndef SI8900_EVENT_WIN_MAX
+    #define SI8900_EVENT_WIN_MAX    128
+#endif
+
+#if (SI8900_EVENT_RING & (SI8900_EVENT_RING - 1)) || (SI8900_EVENT_RING <= SI8900_EVENT_PRE)
+    #error "SI8900_EVENT_RING must be a power of 2 larger than SI8900_EVENT_PRE."
+#endif
+
+
+/*
+ * thresholds, percent of nominal RMS
+ */
+#define SI8900_INTERRUPT_PCT    10
+#define SI8900_SAG_PCT          90
+#define SI8900_SWELL_PCT        110
+#define SI8900_EVENT_HYST_PCT   2
+
+
+/*
+ * event types
+ */
+#define SI8900_EVENT_NONE       0
+#define SI8900_EVENT_SAG        1
+#define SI8900_EVENT_SWELL      2
+#define SI8900_EVENT_INTERRUPT  3
+
+
+/*
+ * EVENT RECORD
+ * wave[0 .. SI8900_EVENT_PRE-1]  : readings before the trigger
+ * wave[SI8900_EVENT_PRE ..]      : readings from the trigger on
+ */
+typedef struct si8900_event_rec{
+    uint8_t type;               // worst type seen during the event
+    uint32_t start;             // reading index of the trigger
+    uint32_t duration;          // readings until the RMS recovered
+    uint16_t extreme_rms;       // lowest (sag/interruption) or highest (swell) half cycle RMS, counts
+    uint16_t wave[SI8900_EVENT_PRE + SI8900_EVENT_POST];
+}si8900_event_rec;
+
+
+/*
+ * DETECTOR STATE
+ */
+typedef struct si8900_event{
+    /* half cycle RMS */
+    int32_t dc_q8;
+    int16_t win[SI8900_EVENT_WIN_MAX];
+    uint16_t win_len;
+    uint16_t win_pos;
+    uint16_t win_fill;
+    uint32_t sum_sq;
+    uint32_t thr_interrupt;     // thresholds as sums of squares over the window
+    uint32_t thr_sag;
+    uint32_t thr_swell;
+    uint32_t thr_sag_end;
+    uint32_t thr_swell_end;
+
+    /* raw reading ring */
+    uint16_t ring[SI8900_EVENT_RING];
+    uint32_t index;             // readings seen so far
+
+    /* event in progress */
+    uint8_t state;              // SI8900_EVENT_x of the ongoing event
+    uint32_t extreme_sq;
+    si8900_event_rec* cap;      // record being filled, NULL when none is
+    uint8_t cap_live;           // cap belongs to the ongoing event
+    uint16_t pre_done;
+    uint16_t post_done;
+
+    /* record queue */
+    si8900_event_rec recs[SI8900_EVENT_RECS];
+    uint8_t rec_head;           // oldest finished record
+    uint8_t rec_used;           // records finished or being filled
+    uint8_t rec_done;           // records ready to read
+    uint16_t dropped;           // events with no free record or started during
+                                // the previous event's capture
+}si8900_event;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_event_init(si8900_event*, uint16_t, uint16_t);
+uint8_t si8900_event_update(si8900_event*, uint16_t);
+uint8_t si8900_event_read(si8900_event*, si8900_event_rec*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_event_H_ */
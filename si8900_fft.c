@@ -0,0 +1,585 @@
+/*
+ * si8900_fft.c
+ * implementation file for the si8900 FFT spectrum engine (host only).
+ * Author: Danyal Ahsanullah
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include "si8900_fft.h" // includes "si8900.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+#define SI8900_PI   3.14159265358979323846
+
+
+/*
+ *  name: si8900_fft_alloc
+ *
+ *  desc: cache line aligned float array
+ */
+static float* si8900_fft_alloc(size_t count)
+{
+    void* p = NULL;
+    if (posix_memalign(&p, 64, count * sizeof(float)) != 0)
+    {
+        return NULL;
+    }
+    return (float*)p;
+}
+
+
+/*
+ *  name: si8900_fft_stage
+ *
+ *  desc: one radix-2 DIT stage of span m over [0, len) of the split arrays
+ */
+static void si8900_fft_stage(const si8900_fft* f, float* re, float* im, uint32_t len, uint32_t m)
+{
+    const float* wr = f->stage_re + (m - 1);
+    const float* wi = f->stage_im + (m - 1);
+    uint32_t g, k;
+
+    for (g = 0; g < len; g += 2 * m)
+    {
+        float* ar = re + g;
+        float* ai = im + g;
+        float* br = ar + m;
+        float* bi = ai + m;
+        k = 0;
+#ifdef __AVX2__
+        for (; k + 8 <= m; k += 8)
+        {
+            __m256 vwr = _mm256_loadu_ps(wr + k);
+            __m256 vwi = _mm256_loadu_ps(wi + k);
+            __m256 vbr = _mm256_loadu_ps(br + k);
+            __m256 vbi = _mm256_loadu_ps(bi + k);
+            __m256 var = _mm256_loadu_ps(ar + k);
+            __m256 vai = _mm256_loadu_ps(ai + k);
+        #ifdef __FMA__
+            __m256 tr = _mm256_fmsub_ps(vbr, vwr, _mm256_mul_ps(vbi, vwi));
+            __m256 ti = _mm256_fmadd_ps(vbr, vwi, _mm256_mul_ps(vbi, vwr));
+        #else
+            __m256 tr = _mm256_sub_ps(_mm256_mul_ps(vbr, vwr), _mm256_mul_ps(vbi, vwi));
+            __m256 ti = _mm256_add_ps(_mm256_mul_ps(vbr, vwi), _mm256_mul_ps(vbi, vwr));
+        #endif
+            _mm256_storeu_ps(br + k, _mm256_sub_ps(var, tr));
+            _mm256_storeu_ps(bi + k, _mm256_sub_ps(vai, ti));
+            _mm256_storeu_ps(ar + k, _mm256_add_ps(var, tr));
+            _mm256_storeu_ps(ai + k, _mm256_add_ps(vai, ti));
+        }
+#endif
+        for (; k < m; k++)
+        {
+            float tr = br[k] * wr[k] - bi[k] * wi[k];
+            float ti = br[k] * wi[k] + bi[k] * wr[k];
+            br[k] = ar[k] - tr;
+            bi[k] = ai[k] - ti;
+            ar[k] += tr;
+            ai[k] += ti;
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_fft_complex
+ *
+ *  desc: in place complex FFT of n/2 points on split arrays
+ */
+static void si8900_fft_complex(const si8900_fft* f, float* re, float* im)
+{
+    uint32_t half = f->n / 2;
+    uint32_t block = (half < SI8900_FFT_BLOCK) ? half : SI8900_FFT_BLOCK;
+    uint32_t i, m, b;
+
+    for (i = 0; i < half; i++)
+    {
+        uint32_t j = f->bitrev[i];
+        if (j > i)
+        {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    // stages that fit in a block, one block at a time
+    for (b = 0; b < half; b += block)
+    {
+        for (m = 1; m < block; m <<= 1)
+        {
+            si8900_fft_stage(f, re + b, im + b, block, m);
+        }
+    }
+    // remaining stages over the whole frame
+    for (m = block; m < half; m <<= 1)
+    {
+        si8900_fft_stage(f, re, im, half, m);
+    }
+}
+
+
+/*
+ *  name: si8900_fft_init
+ *
+ *  desc: builds an FFT plan for real frames of n points
+ *
+ *  args:
+ *      si8900_fft* f  : plan to build
+ *      uint32_t n     : frame length, power of 2, at least 16
+ *      uint8_t window : SI8900_WIN_RECT, SI8900_WIN_HANN or SI8900_WIN_BLACKMAN
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a bad length or out of memory
+ *
+ *  example:
+ *      si8900_fft plan;
+ *      if (si8900_fft_init(&plan, 4096, SI8900_WIN_HANN))
+ *      {
+ *          // throw error
+ *      }
+ */
+uint8_t si8900_fft_init(si8900_fft* f, uint32_t n, uint8_t window)
+{
+    uint32_t half = n / 2, i, m, bits = 0;
+    double wsum = 0.0;
+
+    f->bitrev = NULL;
+    f->stage_re = f->stage_im = f->split_re = f->split_im = f->window = NULL;
+    if (n < 16 || (n & (n - 1)))
+    {
+        return FAILED;
+    }
+    while ((1u << bits) < half)
+    {
+        bits++;
+    }
+    f->n = n;
+    f->log2_half = bits;
+
+    f->bitrev = (uint32_t*)malloc(half * sizeof(uint32_t));
+    f->stage_re = si8900_fft_alloc(half);
+    f->stage_im = si8900_fft_alloc(half);
+    f->split_re = si8900_fft_alloc(half + 1);
+    f->split_im = si8900_fft_alloc(half + 1);
+    f->window = si8900_fft_alloc(n);
+    if (!f->bitrev || !f->stage_re || !f->stage_im || !f->split_re || !f->split_im || !f->window)
+    {
+        si8900_fft_free(f);
+        return FAILED;
+    }
+
+    for (i = 0; i < half; i++)
+    {
+        uint32_t r = 0, v = i, b;
+        for (b = 0; b < bits; b++)
+        {
+            r = (r << 1) | (v & 1);
+            v >>= 1;
+        }
+        f->bitrev[i] = r;
+    }
+
+    for (m = 1; m < half; m <<= 1)
+    {
+        for (i = 0; i < m; i++)
+        {
+            double a = -SI8900_PI * i / m;
+            f->stage_re[m - 1 + i] = (float)cos(a);
+            f->stage_im[m - 1 + i] = (float)sin(a);
+        }
+    }
+
+    for (i = 0; i <= half; i++)
+    {
+        double a = -2.0 * SI8900_PI * i / n;
+        f->split_re[i] = (float)cos(a);
+        f->split_im[i] = (float)sin(a);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        double a = 2.0 * SI8900_PI * i / n;
+        double w;
+        switch (window)
+        {
+        case SI8900_WIN_HANN:
+            w = 0.5 - 0.5 * cos(a);
+            break;
+        case SI8900_WIN_BLACKMAN:
+            w = 0.35875 - 0.48829 * cos(a) + 0.14128 * cos(2.0 * a) - 0.01168 * cos(3.0 * a);
+            break;
+        default:
+            w = 1.0;
+            break;
+        }
+        f->window[i] = (float)w;
+        wsum += w;
+    }
+    f->mag_scale = (float)(2.0 / wsum);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_fft_free
+ *
+ *  desc: releases the tables of a plan
+ *
+ *  args:
+ *      si8900_fft* f : plan to release
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_fft_free(&plan);
+ */
+void si8900_fft_free(si8900_fft* f)
+{
+    free(f->bitrev);
+    free(f->stage_re);
+    free(f->stage_im);
+    free(f->split_re);
+    free(f->split_im);
+    free(f->window);
+    f->bitrev = NULL;
+    f->stage_re = f->stage_im = f->split_re = f->split_im = f->window = NULL;
+}
+
+
+/*
+ *  name: si8900_fft_work_alloc
+ *
+ *  desc: allocates the scratch space one thread needs for
+ *        si8900_fft_magnitude (n floats). Release with free().
+ *
+ *  args:
+ *      const si8900_fft* f : plan
+ *
+ *  return value:
+ *      float*: scratch space, NULL when out of memory
+ *
+ *  example:
+ *      float* work = si8900_fft_work_alloc(&plan);
+ */
+float* si8900_fft_work_alloc(const si8900_fft* f)
+{
+    return si8900_fft_alloc(f->n);
+}
+
+
+/*
+ *  name: si8900_fft_magnitude
+ *
+ *  desc: windows one frame of n real points and writes the magnitude of
+ *        its n/2 + 1 bins
+ *
+ *  args:
+ *      const si8900_fft* f : plan
+ *      const float* in     : n input points
+ *      float* work         : scratch from si8900_fft_work_alloc
+ *      float* mag          : n/2 + 1 magnitudes out, bin k at k * fs / n
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_fft_magnitude(&plan, volts + start, work, mag);
+ */
+void si8900_fft_magnitude(const si8900_fft* f, const float* in, float* work, float* mag)
+{
+    uint32_t half = f->n / 2, k;
+    float* re = work;
+    float* im = work + half;
+
+    // pack even / odd points as re / im
+    for (k = 0; k < half; k++)
+    {
+        re[k] = in[2 * k] * f->window[2 * k];
+        im[k] = in[2 * k + 1] * f->window[2 * k + 1];
+    }
+    si8900_fft_complex(f, re, im);
+
+    // split the packed spectrum: X[k] = Fe[k] + W^k Fo[k]
+    mag[0] = fabsf(re[0] + im[0]) * f->mag_scale * 0.5f;
+    mag[half] = fabsf(re[0] - im[0]) * f->mag_scale * 0.5f;
+    for (k = 1; k < half; k++)
+    {
+        float zr = re[k], zi = im[k];
+        float cr = re[half - k], ci = -im[half - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float or_ = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+        float xr = er + f->split_re[k] * or_ - f->split_im[k] * oi;
+        float xi = ei + f->split_re[k] * oi + f->split_im[k] * or_;
+        mag[k] = sqrtf(xr * xr + xi * xi) * f->mag_scale;
+    }
+}
+
+
+/*
+ *  name: si8900_fft_frames
+ *
+ *  desc: number of frames si8900_fft_spectrogram produces
+ *
+ *  args:
+ *      const si8900_fft* f : plan
+ *      size_t len          : input points
+ *      uint32_t hop        : points between frame starts (n / 2 for 50 % overlap)
+ *
+ *  return value:
+ *      size_t: frame count
+ *
+ *  example:
+ *      float* mags = malloc(si8900_fft_frames(&plan, len, 2048) * 2049 * sizeof(float));
+ */
+size_t si8900_fft_frames(const si8900_fft* f, size_t len, uint32_t hop)
+{
+    if (len < f->n || hop == 0)
+    {
+        return 0;
+    }
+    return (len - f->n) / hop + 1;
+}
+
+
+/*
+ * work split between spectrogram threads
+ */
+typedef struct si8900_fft_job{
+    const si8900_fft* f;
+    const float* in;
+    float* mags;
+    uint32_t hop;
+    size_t first;
+    size_t last;
+    uint8_t status;
+}si8900_fft_job;
+
+static void* si8900_fft_worker(void* arg)
+{
+    si8900_fft_job* job = (si8900_fft_job*)arg;
+    size_t bins = job->f->n / 2 + 1, i;
+    float* work = si8900_fft_work_alloc(job->f);
+
+    if (!work)
+    {
+        job->status = FAILED;
+        return NULL;
+    }
+    for (i = job->first; i < job->last; i++)
+    {
+        si8900_fft_magnitude(job->f, job->in + i * job->hop, work, job->mags + i * bins);
+    }
+    free(work);
+    job->status = 0;
+    return NULL;
+}
+
+
+/*
+ *  name: si8900_fft_spectrogram
+ *
+ *  desc: magnitude spectra of windowed, overlapping frames over a long
+ *        array, split across threads
+ *
+ *  args:
+ *      const si8900_fft* f : plan
+ *      const float* in     : input points, eg: from si8900_convert_f32
+ *      size_t len          : number of input points
+ *      uint32_t hop        : points between frame starts
+ *      float* mags         : si8900_fft_frames() * (n/2 + 1) magnitudes out,
+ *                            frame by frame
+ *      uint32_t threads    : worker threads, 0 for one per online core
+ *
+ *  return value:
+ *      size_t: frames written, 0 on failure
+ *
+ *  example:
+ *      size_t frames = si8900_fft_spectrogram(&plan, volts, len, 2048, mags, 0);
+ */
+size_t si8900_fft_spectrogram(const si8900_fft* f, const float* in, size_t len, uint32_t hop, float* mags, uint32_t threads)
+{
+    size_t frames = si8900_fft_frames(f, len, hop);
+    si8900_fft_job* jobs;
+    pthread_t* tids;
+    uint32_t t, started = 0;
+    uint8_t failed = 0;
+
+    if (!frames)
+    {
+        return 0;
+    }
+    if (!threads)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0) ? (uint32_t)cores : 1;
+    }
+    if (threads > frames)
+    {
+        threads = (uint32_t)frames;
+    }
+
+    jobs = (si8900_fft_job*)malloc(threads * sizeof(si8900_fft_job));
+    tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    if (!jobs || !tids)
+    {
+        free(jobs);
+        free(tids);
+        return 0;
+    }
+
+    for (t = 0; t < threads; t++)
+    {
+        jobs[t].f = f;
+        jobs[t].in = in;
+        jobs[t].mags = mags;
+        jobs[t].hop = hop;
+        jobs[t].first = frames * t / threads;
+        jobs[t].last = frames * (t + 1) / threads;
+        jobs[t].status = FAILED;
+    }
+    // the calling thread takes the first share
+    for (t = 1; t < threads; t++)
+    {
+        if (pthread_create(&tids[t], NULL, si8900_fft_worker, &jobs[t]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    si8900_fft_worker(&jobs[0]);
+    for (t = 1; t <= started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    // shares that never got a thread
+    for (t = started + 1; t < threads; t++)
+    {
+        si8900_fft_worker(&jobs[t]);
+    }
+    for (t = 0; t < threads; t++)
+    {
+        failed |= (jobs[t].status != 0);
+    }
+
+    free(jobs);
+    free(tids);
+    return failed ? 0 : frames;
+}
+
+
+/*
+ *  name: si8900_fft_check
+ *
+ *  desc: compares one plan against a direct O(n^2) DFT in double, both
+ *        the packed n/2 point complex FFT and the split real spectrum.
+ *        Returns the worst error relative to the largest DFT magnitude.
+ */
+static double si8900_fft_check(uint32_t n, uint32_t seed)
+{
+    si8900_fft f;
+    uint32_t half = n / 2, i, k;
+    float* in = si8900_fft_alloc(n);
+    float* work = si8900_fft_alloc(n);
+    float* mag = si8900_fft_alloc(half + 1);
+    double worst = 1.0, peak = 0.0, err = 0.0;
+
+    if (!in || !work || !mag || si8900_fft_init(&f, n, SI8900_WIN_RECT))
+    {
+        free(in);
+        free(work);
+        free(mag);
+        return worst;
+    }
+    for (i = 0; i < n; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        in[i] = (float)((seed >> 8) & 0xFFFF) / 32768.0f - 1.0f;
+    }
+
+    // complex stages: even / odd points packed as re / im
+    for (i = 0; i < half; i++)
+    {
+        work[i] = in[2 * i];
+        work[half + i] = in[2 * i + 1];
+    }
+    si8900_fft_complex(&f, work, work + half);
+    for (k = 0; k < half; k++)
+    {
+        double xr = 0.0, xi = 0.0;
+        for (i = 0; i < half; i++)
+        {
+            double a = -2.0 * SI8900_PI * (double)((uint64_t)i * k % half) / half;
+            xr += in[2 * i] * cos(a) - in[2 * i + 1] * sin(a);
+            xi += in[2 * i] * sin(a) + in[2 * i + 1] * cos(a);
+        }
+        peak = fmax(peak, sqrt(xr * xr + xi * xi));
+        err = fmax(err, hypot(work[k] - xr, work[half + k] - xi));
+    }
+
+    // real spectrum through the split, magnitudes as scaled by the plan
+    si8900_fft_magnitude(&f, in, work, mag);
+    for (k = 0; k <= half; k++)
+    {
+        double xr = 0.0, xi = 0.0, scale = (k == 0 || k == half) ? 0.5 : 1.0;
+        for (i = 0; i < n; i++)
+        {
+            double a = -2.0 * SI8900_PI * (double)((uint64_t)i * k % n) / n;
+            xr += in[i] * cos(a);
+            xi += in[i] * sin(a);
+        }
+        peak = fmax(peak, sqrt(xr * xr + xi * xi));
+        err = fmax(err, fabs(mag[k] / f.mag_scale / scale - sqrt(xr * xr + xi * xi)));
+    }
+
+    si8900_fft_free(&f);
+    free(in);
+    free(work);
+    free(mag);
+    return (peak > 0.0) ? err / peak : worst;
+}
+
+
+/*
+ *  name: si8900_fft_selftest
+ *
+ *  desc: checks the FFT against a direct DFT for the smallest frame, one
+ *        that runs the AVX2 butterflies (when built with them) and one
+ *        large enough for the cache blocked stages. Takes a fraction of a
+ *        second; run it once per build flavour (eg: with and without
+ *        -mavx2 -mfma) when porting or changing the butterflies.
+ *
+ *  args:
+ *      void
+ *
+ *  return value:
+ *      uint8_t with value 0 when every size agrees to 1e-5 of full scale,
+ *      FAILED otherwise (or when out of memory)
+ *
+ *  example:
+ *      if (si8900_fft_selftest())
+ *      {
+ *          // throw error
+ *      }
+ */
+uint8_t si8900_fft_selftest(void)
+{
+    static const uint32_t sizes[] = {16, 64, 4 * SI8900_FFT_BLOCK};
+    uint32_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        if (!(si8900_fft_check(sizes[i], 12345u + i) <= 1e-5))
+        {
+            return FAILED;
+        }
+    }
+    return 0;
+}
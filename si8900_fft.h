@@ -0,0 +1,88 @@
+/*
+ * si8900_fft.h
+ * radix-2 real input FFT spectrum engine for si8900 captures (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and pthreads.
+ *
+ *  A real frame of n points is packed into n/2 complex points and run
+ *  through an in place, iterative radix-2 FFT on split re/im arrays, then
+ *  split back into the n/2 + 1 bins of the real spectrum. Twiddles and the
+ *  bit reversal table are computed once per plan.
+ *
+ *  The early stages are run one SI8900_FFT_BLOCK sized block at a time so
+ *  they stay in L1, the later stages sweep the whole frame. Butterflies
+ *  with a span of 8 or more use AVX2 (and FMA) when the compiler targets it.
+ *
+ *  si8900_fft_spectrogram runs windowed, overlapping frames over a long
+ *  array of converted readings (see si8900_convert.h) across threads.
+ *  Magnitudes are scaled so a sine of peak amplitude A reads A in its bin.
+ *
+ *  si8900_fft_selftest checks the butterflies the build compiled (scalar
+ *  or AVX2), the cache blocked stages and the real split against a direct
+ *  DFT.
+ */
+
+#ifndef si8900_fft_H_
+#define si8900_fft_H_
+
+#ifndef PC_
+    #error "si8900_fft is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+/*
+ * window shapes
+ */
+#define SI8900_WIN_RECT     0
+#define SI8900_WIN_HANN     1
+#define SI8900_WIN_BLACKMAN 2   // 4 term blackman-harris
+
+
+/*
+ * complex points per cache block for the early stages (power of 2)
+ */
+#ifndef SI8900_FFT_BLOCK
+    #define SI8900_FFT_BLOCK    1024
+#endif
+
+
+/*
+ * FFT PLAN -- read only once built, may be shared between threads
+ */
+typedef struct si8900_fft{
+    uint32_t n;         // real frame length, power of 2, >= 16
+    uint32_t log2_half; // log2(n / 2)
+    uint32_t* bitrev;   // bit reversal of 0 .. n/2 - 1
+    float* stage_re;    // per stage twiddles, stage with span m at [m - 1, 2m - 1)
+    float* stage_im;
+    float* split_re;    // real split twiddles, e^(-2 pi i k / n), k = 0 .. n/2
+    float* split_im;
+    float* window;      // n window coefficients
+    float mag_scale;    // 2 / sum(window)
+}si8900_fft;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_fft_init(si8900_fft*, uint32_t, uint8_t);
+void si8900_fft_free(si8900_fft*);
+float* si8900_fft_work_alloc(const si8900_fft*);
+void si8900_fft_magnitude(const si8900_fft*, const float*, float*, float*);
+size_t si8900_fft_frames(const si8900_fft*, size_t, uint32_t);
+size_t si8900_fft_spectrogram(const si8900_fft*, const float*, size_t, uint32_t, float*, uint32_t);
+uint8_t si8900_fft_selftest(void);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_fft_H_ */
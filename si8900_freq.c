@@ -0,0 +1,110 @@
+/*
+ * si8900_freq.c
+ * implementation file for the si8900 streaming mains frequency estimator.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_freq.h" // includes "si8900.h"
+
+
+/*
+ *  name: si8900_freq_init
+ *
+ *  desc: sets up a frequency tracker for one channel
+ *
+ *  args:
+ *      si8900_freq* f    : tracker to set up
+ *      uint32_t fs_mhz   : rate readings are fed at, in millihertz
+ *      uint8_t n_cycles  : mains cycles to average each estimate over (>= 1)
+ *      uint16_t hyst     : hysteresis in reading counts around zero
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_freq freq;
+ *      si8900_freq_init(&freq, 2000000, 10, 8); // 2 kHz, 10 cycles, +-8 counts
+ */
+void si8900_freq_init(si8900_freq* f, uint32_t fs_mhz, uint8_t n_cycles, uint16_t hyst)
+{
+    f->dc_q8 = (int32_t)(SI8900_RES / 2) << 8;
+    f->prev_q8 = 0;
+    f->hyst_q8 = (int32_t)hyst << 8;
+    f->fs_mhz = fs_mhz;
+    f->n_cycles = n_cycles ? n_cycles : 1;
+    f->max_q8 = (fs_mhz / (SI8900_FREQ_MIN_HZ * 1000UL) + 1) * 256UL * (f->n_cycles + 1);
+    f->cycles = 0;
+    f->armed = 0;
+    f->started = 0;
+    f->valid = 0;
+    f->freq_mhz = SI8900_FREQ_NOMINAL_MHZ;
+}
+
+
+/*
+ *  name: si8900_freq_update
+ *
+ *  desc: feeds one reading to the tracker
+ *
+ *  args:
+ *      si8900_freq* f   : tracker
+ *      uint16_t reading : next reading of the tracked channel
+ *
+ *  return value:
+ *      uint8_t: 1 when a new frequency was published to f->freq_mhz, else 0
+ *
+ *  example:
+ *      if (reading.inch == 0 && si8900_freq_update(&freq, reading.reading))
+ *      {
+ *          display_mhz(freq.freq_mhz);
+ *      }
+ */
+uint8_t si8900_freq_update(si8900_freq* f, uint16_t reading)
+{
+    int32_t x_q8 = (int32_t)reading << 8;
+    int32_t ac_q8;
+    uint8_t published = 0;
+
+    f->dc_q8 += (x_q8 - f->dc_q8) >> SI8900_FREQ_DC_SHIFT;
+    ac_q8 = x_q8 - f->dc_q8;
+
+    if (f->started)
+    {
+        f->since_q8 += 256;
+        if (f->since_q8 > f->max_q8)
+        {
+            f->started = 0; // lost the signal, start over
+            f->valid = 0;
+            f->freq_mhz = SI8900_FREQ_NOMINAL_MHZ;
+        }
+    }
+
+    if (ac_q8 <= -f->hyst_q8)
+    {
+        f->armed = 1;
+    }
+    else if (f->armed && f->prev_q8 < 0 && ac_q8 >= 0)
+    {
+        // crossing sits frac readings after the previous reading
+        uint32_t frac_q8 = (uint32_t)(((-f->prev_q8) << 8) / (ac_q8 - f->prev_q8));
+        f->armed = 0;
+
+        if (!f->started)
+        {
+            f->started = 1;
+            f->cycles = 0;
+            f->since_q8 = 256 - frac_q8;
+        }
+        else if (++f->cycles >= f->n_cycles)
+        {
+            uint32_t window_q8 = f->since_q8 - 256 + frac_q8;
+            f->freq_mhz = (uint32_t)(((uint64_t)f->fs_mhz * f->n_cycles * 256) / window_q8);
+            f->valid = 1;
+            published = 1;
+            f->cycles = 0;
+            f->since_q8 = 256 - frac_q8;
+        }
+    }
+
+    f->prev_q8 = ac_q8;
+    return published;
+}
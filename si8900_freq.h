@@ -0,0 +1,69 @@
+/*
+ * si8900_freq.h
+ * streaming mains frequency estimator for si8900 readings.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Integer only, O(1) per reading -- safe to run in the MSP430 main loop.
+ *
+ *  Per reading:
+ *      - DC is removed with a first order IIR (time constant 2^SI8900_FREQ_DC_SHIFT readings)
+ *      - the AC value must drop below -hysteresis to arm the next rising crossing
+ *      - the rising zero crossing is placed between readings by linear
+ *        interpolation (1/256 of a reading resolution)
+ *      - after n_cycles crossings the mean period is turned into a frequency
+ *        in millihertz
+ *
+ *  The sample rate is given in millihertz so UART paced rates that are not
+ *  a whole number of Hz can be used.
+ */
+
+#ifndef si8900_freq_H_
+#define si8900_freq_H_
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+/*
+ * tuning constants
+ */
+#define SI8900_FREQ_DC_SHIFT    10      // DC tracking time constant, 2^n readings
+#define SI8900_FREQ_MIN_HZ      40      // below this the estimate is dropped as invalid
+#define SI8900_FREQ_NOMINAL_MHZ ((uint32_t)(MAINS_FRQ * 1000))
+
+
+/*
+ * FREQUENCY TRACKER STATE
+ * values suffixed _q8 are fixed point with 8 fractional bits
+ */
+typedef struct si8900_freq{
+    int32_t dc_q8;          // DC estimate
+    int32_t prev_q8;        // previous AC value
+    int32_t hyst_q8;        // arming threshold
+    uint32_t fs_mhz;        // sample rate
+    uint32_t since_q8;      // readings since the first crossing of the window
+    uint32_t max_q8;        // window length that means the signal was lost
+    uint8_t n_cycles;       // cycles to average over
+    uint8_t cycles;         // cycles seen in the current window
+    uint8_t armed;          // went below -hysteresis since the last crossing
+    uint8_t started;        // window open (first crossing seen)
+    uint8_t valid;          // freq_mhz holds a measured value
+    uint32_t freq_mhz;      // published frequency, SI8900_FREQ_NOMINAL_MHZ until valid
+}si8900_freq;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_freq_init(si8900_freq*, uint32_t, uint8_t, uint16_t);
+uint8_t si8900_freq_update(si8900_freq*, uint16_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_freq_H_ */
@@ -0,0 +1,276 @@
+/*
+ * si8900_harmonic.c
+ * implementation file for the si8900 Goertzel harmonic and THD tracker.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_harmonic.h" // includes "si8900_freq.h"
+
+
+#define SI8900_Q30          (1L << 30)
+#define SI8900_TWO_PI_Q30   6746518852LL    // 2 pi in Q30
+#define SI8900_PI_Q30       3373259426LL    // pi in Q30
+
+
+/*
+ *  name: si8900_isqrt64
+ *
+ *  desc: integer square root, floor(sqrt(v))
+ */
+static uint32_t si8900_isqrt64(uint64_t v)
+{
+    uint64_t root = 0, bit = (uint64_t)1 << 62;
+    while (bit > v)
+    {
+        bit >>= 2;
+    }
+    while (bit)
+    {
+        if (v >= root + bit)
+        {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+
+/*
+ *  name: si8900_cos_q30
+ *
+ *  desc: cosine of an angle in Q30 radians, 0 <= x <= pi/2,
+ *        taylor series to the x^10 term (error < 1e-6)
+ */
+static int64_t si8900_cos_q30(int64_t x)
+{
+    int64_t x2 = (x * x) >> 30;
+    // horner form of 1 - x2/2 (1 - x2/12 (1 - x2/30 (1 - x2/56 (1 - x2/90))))
+    int64_t acc = SI8900_Q30 - x2 / 90;
+    acc = SI8900_Q30 - ((x2 * acc) >> 30) / 56;
+    acc = SI8900_Q30 - ((x2 * acc) >> 30) / 30;
+    acc = SI8900_Q30 - ((x2 * acc) >> 30) / 12;
+    acc = SI8900_Q30 - ((x2 * acc) >> 30) / 2;
+    return acc;
+}
+
+
+/*
+ *  name: si8900_harm_fits
+ *
+ *  desc: whether a bin at angle w (c_q30 = cos(w)) keeps its goertzel state
+ *        inside +-2^29 over a window of len readings. A reading is at most
+ *        2^14 in Q4 and |s| <= len * 2^14 / sin(w), so len / sin(w) must not
+ *        exceed 2^15.
+ */
+static uint8_t si8900_harm_fits(uint32_t len, int64_t c_q30)
+{
+    uint64_t one = (uint64_t)SI8900_Q30 * SI8900_Q30;
+    uint64_t cc = (uint64_t)(c_q30 * c_q30);
+    uint64_t sin_q30;
+
+    if (cc >= one)
+    {
+        return 0;
+    }
+    sin_q30 = si8900_isqrt64(one - cc);
+    return ((uint64_t)len << 30) <= (sin_q30 << 15);
+}
+
+
+/*
+ *  name: si8900_harm_start
+ *
+ *  desc: sizes the next window from the tracked fundamental and
+ *        recomputes the bin coefficients. The window is shortened by whole
+ *        cycles until the fundamental bin fits (see si8900_harm_fits).
+ */
+static void si8900_harm_start(si8900_harm* h)
+{
+    uint8_t cycles = h->n_cycles;
+    uint32_t len;
+    int64_t theta, c1, c_prev, c_cur, c_next;
+    uint8_t b;
+
+    h->pos = 0;
+    h->n_bins = 0;
+    for (;;)
+    {
+        len = (uint32_t)(((uint64_t)h->fs_mhz * cycles + h->freq.freq_mhz / 2) / h->freq.freq_mhz);
+        if (len > 0xFFFFu)
+        {
+            len = 0xFFFFu;
+        }
+        h->win_len = (uint16_t)(len ? len : 1);
+        if (len < 4UL * cycles)
+        {
+            return; // fewer than 4 readings per cycle, nothing to track
+        }
+
+        // fundamental bin sits cycles bins up, harmonic h at h * cycles
+        theta = SI8900_TWO_PI_Q30 * cycles / len;
+        c1 = si8900_cos_q30(theta);
+        if (si8900_harm_fits(len, c1))
+        {
+            break;
+        }
+        if (cycles == 1)
+        {
+            return; // too many readings per cycle for the state to fit
+        }
+        cycles--;
+    }
+
+    // cos(b theta) by chebyshev recurrence
+    c_prev = SI8900_Q30;
+    c_cur = c1;
+    for (b = 0; b < SI8900_HARM_MAX; b++)
+    {
+        if (theta * (b + 1) >= SI8900_PI_Q30 || !si8900_harm_fits(len, c_cur))
+        {
+            break; // at or too close to nyquist
+        }
+        h->coef_q28[b] = (int32_t)(c_cur >> 1);
+        h->s1[b] = 0;
+        h->s2[b] = 0;
+        h->n_bins++;
+        c_next = ((2 * c1 * c_cur) >> 30) - c_prev;
+        c_prev = c_cur;
+        c_cur = c_next;
+    }
+}
+
+
+/*
+ *  name: si8900_harm_finish
+ *
+ *  desc: turns the goertzel states of a finished window into
+ *        magnitudes and THD, or clears valid when no bin was tracked
+ */
+static void si8900_harm_finish(si8900_harm* h)
+{
+    uint64_t harm_pwr = 0;
+    uint32_t fund_root = 0;
+    uint8_t b;
+
+    if (!h->n_bins)
+    {
+        h->valid = 0; // nothing was tracked, an all zero result would read as a clean signal
+        return;
+    }
+    for (b = 0; b < SI8900_HARM_MAX; b++)
+    {
+        uint64_t pwr = 0;
+        if (b < h->n_bins)
+        {
+            int64_t s1 = h->s1[b], s2 = h->s2[b];
+            int64_t p = s1 * s1 + s2 * s2 - ((((int64_t)h->coef_q28[b] * s1) >> 28) * s2);
+            pwr = (p > 0) ? (uint64_t)p : 0;
+        }
+        // |X| = N A / 2 for a tone of peak amplitude A
+        h->mag_q4[b] = (uint32_t)(2ULL * si8900_isqrt64(pwr) / h->win_len);
+        if (b == 0)
+        {
+            fund_root = si8900_isqrt64(pwr);
+        }
+        else
+        {
+            harm_pwr += pwr;
+        }
+    }
+
+    if (fund_root)
+    {
+        uint64_t thd = (uint64_t)si8900_isqrt64(harm_pwr) * 10000ULL / fund_root;
+        h->thd_bp = (thd > 0xFFFFu) ? 0xFFFFu : (uint16_t)thd;
+    }
+    else
+    {
+        h->thd_bp = 0;
+    }
+    h->valid = 1;
+}
+
+
+/*
+ *  name: si8900_harm_init
+ *
+ *  desc: sets up a harmonic tracker for one channel
+ *
+ *  args:
+ *      si8900_harm* h    : tracker to set up
+ *      uint32_t fs_mhz   : rate readings are fed at, in millihertz
+ *      uint8_t n_cycles  : mains cycles per analysis window (>= 1), an upper
+ *                          limit -- see the notes in si8900_harmonic.h
+ *      uint16_t hyst     : zero crossing hysteresis for the fundamental tracker
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_harm harm;
+ *      si8900_harm_init(&harm, 3000000, 10, 8); // 3 kHz readings, 10 cycle windows
+ */
+void si8900_harm_init(si8900_harm* h, uint32_t fs_mhz, uint8_t n_cycles, uint16_t hyst)
+{
+    uint8_t b;
+    si8900_freq_init(&h->freq, fs_mhz, n_cycles, hyst);
+    h->fs_mhz = fs_mhz;
+    h->n_cycles = n_cycles ? n_cycles : 1;
+    for (b = 0; b < SI8900_HARM_MAX; b++)
+    {
+        h->mag_q4[b] = 0;
+    }
+    h->thd_bp = 0;
+    h->valid = 0;
+    si8900_harm_start(h);
+}
+
+
+/*
+ *  name: si8900_harm_update
+ *
+ *  desc: feeds one reading to the harmonic tracker
+ *
+ *  args:
+ *      si8900_harm* h   : tracker
+ *      uint16_t reading : next reading of the tracked channel
+ *
+ *  return value:
+ *      uint8_t: 1 when a window finished and mag_q4 / thd_bp were updated,
+ *               0 otherwise (also for windows with nothing to track, which
+ *               clear valid)
+ *
+ *  example:
+ *      if (reading.inch == 0 && si8900_harm_update(&harm, reading.reading))
+ *      {
+ *          report(harm.thd_bp, harm.mag_q4[2], harm.mag_q4[4], harm.mag_q4[6]);
+ *      }
+ */
+uint8_t si8900_harm_update(si8900_harm* h, uint16_t reading)
+{
+    int32_t x_q4;
+    uint8_t b;
+
+    si8900_freq_update(&h->freq, reading);
+    x_q4 = (((int32_t)reading << 8) - h->freq.dc_q8) >> 4;
+
+    for (b = 0; b < h->n_bins; b++)
+    {
+        int32_t s0 = x_q4 + (int32_t)(((int64_t)h->coef_q28[b] * h->s1[b]) >> 28) - h->s2[b];
+        h->s2[b] = h->s1[b];
+        h->s1[b] = s0;
+    }
+
+    if (++h->pos >= h->win_len)
+    {
+        si8900_harm_finish(h);
+        si8900_harm_start(h);
+        return h->valid;
+    }
+    return 0;
+}
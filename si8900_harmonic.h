@@ -0,0 +1,76 @@
+/*
+ * si8900_harmonic.h
+ * streaming Goertzel harmonic and THD tracker for the mains channel.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Integer only -- meant for parts without an FPU.
+ *
+ *  A bank of Goertzel filters, one per harmonic 1 .. SI8900_HARM_MAX, runs
+ *  over a window of n_cycles mains cycles. The window length is taken from
+ *  the fundamental tracked by si8900_freq (MAINS_FRQ until it locks), and
+ *  the coefficients are recomputed in fixed point at the start of every
+ *  window. Each reading costs one multiply-add per bin; the waveform is
+ *  not stored.
+ *
+ *  The Goertzel state is kept in 32 bits, which bounds the window: a bin at
+ *  angle w may see at most 2^15 * sin(w) readings. Windows are shortened
+ *  by whole cycles to fit, so n_cycles is an upper limit -- e.g. at 50 Hz,
+ *  10 cycles fit up to about 7 kHz readings and a single cycle up to about
+ *  22 kHz. Above that, or below 4 readings per cycle, nothing is tracked
+ *  and valid stays 0. Harmonics too close to nyquist for the bound are
+ *  left out of the window.
+ *
+ *  At the end of a window the peak amplitude of every harmonic (in 1/16
+ *  reading counts) and the THD (in 0.01 % units) are published.
+ *
+ *  Optional values: -- define in build config
+ *      SI8900_HARM_MAX : highest harmonic tracked, default 7
+ */
+
+#ifndef si8900_harmonic_H_
+#define si8900_harmonic_H_
+
+/*
+ * includes
+ */
+#include "si8900_freq.h" // includes "si8900.h"
+
+
+#ifndef SI8900_HARM_MAX
+    #define SI8900_HARM_MAX 7
+#endif
+
+
+/*
+ * HARMONIC TRACKER STATE
+ * harmonic h lives at index h-1 of the per bin arrays
+ */
+typedef struct si8900_harm{
+    si8900_freq freq;                   // fundamental and DC tracking
+    uint32_t fs_mhz;                    // reading rate
+    uint8_t n_cycles;                   // cycles per window
+    uint8_t n_bins;                     // bins below nyquist this window
+    uint16_t win_len;                   // readings per window
+    uint16_t pos;                       // readings into the current window
+    int32_t coef_q28[SI8900_HARM_MAX];  // 2cos(w) per bin
+    int32_t s1[SI8900_HARM_MAX];        // goertzel state per bin
+    int32_t s2[SI8900_HARM_MAX];
+    uint32_t mag_q4[SI8900_HARM_MAX];   // published peak amplitude per harmonic
+    uint16_t thd_bp;                    // published THD, 0.01 % units
+    uint8_t valid;                      // the last window was published
+}si8900_harm;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_harm_init(si8900_harm*, uint32_t, uint8_t, uint16_t);
+uint8_t si8900_harm_update(si8900_harm*, uint16_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_harmonic_H_ */
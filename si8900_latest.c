@@ -0,0 +1,272 @@
+/*
+ * si8900_latest.c
+ * implementation file for the si8900 latest value table.
+ * Author: Danyal Ahsanullah
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include "si8900_latest.h" // includes "si8900_block.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ *  name: si8900_latest_create
+ *
+ *  desc: creates (or replaces) a named table with every slot empty and
+ *        maps it for writing. An old table is unlinked, never truncated
+ *        under readers still mapping it; they keep its last values until
+ *        they reopen the name. Only one writer may use a table.
+ *
+ *  args:
+ *      si8900_latest* t : handle to fill
+ *      const char* name : shared memory name, eg: "/si8900_latest"
+ *      uint32_t n_dev   : number of devices
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a system error
+ *
+ *  example:
+ *      si8900_latest table;
+ *      si8900_latest_create(&table, "/si8900_latest", 4);
+ */
+uint8_t si8900_latest_create(si8900_latest* t, const char* name, uint32_t n_dev)
+{
+    size_t len = sizeof(si8900_latest_hdr) + (size_t)n_dev * SI8900_NUM_CH * sizeof(si8900_latest_slot);
+    void* map;
+    int fd;
+
+    t->hdr = NULL;
+    if (!n_dev)
+    {
+        return FAILED;
+    }
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        return FAILED;
+    }
+    if (ftruncate(fd, (off_t)len) != 0) // zero filled: seq 0, updates 0
+    {
+        close(fd);
+        shm_unlink(name);
+        return FAILED;
+    }
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return FAILED;
+    }
+
+    t->hdr = (si8900_latest_hdr*)map;
+    t->slot = (si8900_latest_slot*)(t->hdr + 1);
+    t->map_len = len;
+
+    t->hdr->n_dev = n_dev;
+    t->hdr->n_ch = SI8900_NUM_CH;
+    t->hdr->version = SI8900_LATEST_VERSION;
+    // readers check the magic last, publish it after everything else
+    __atomic_store_n(&t->hdr->magic, SI8900_LATEST_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_latest_open
+ *
+ *  desc: maps an existing table read only
+ *
+ *  args:
+ *      si8900_latest* t : handle to fill
+ *      const char* name : shared memory name given to si8900_latest_create
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when the table does not
+ *      exist or does not match this build
+ *
+ *  example:
+ *      si8900_latest table;
+ *      if (si8900_latest_open(&table, "/si8900_latest")) { ... }
+ */
+uint8_t si8900_latest_open(si8900_latest* t, const char* name)
+{
+    struct stat st;
+    void* map;
+    int fd;
+
+    t->hdr = NULL;
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return FAILED;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(si8900_latest_hdr))
+    {
+        close(fd);
+        return FAILED;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return FAILED;
+    }
+
+    t->hdr = (si8900_latest_hdr*)map;
+    t->slot = (si8900_latest_slot*)(t->hdr + 1);
+    t->map_len = (size_t)st.st_size;
+    if (__atomic_load_n(&t->hdr->magic, __ATOMIC_ACQUIRE) != SI8900_LATEST_MAGIC ||
+        t->hdr->version != SI8900_LATEST_VERSION ||
+        t->hdr->n_ch != SI8900_NUM_CH ||
+        sizeof(si8900_latest_hdr) + (size_t)t->hdr->n_dev * SI8900_NUM_CH * sizeof(si8900_latest_slot) > t->map_len)
+    {
+        si8900_latest_close(t);
+        return FAILED;
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_latest_close
+ *
+ *  desc: unmaps a table, the shared memory stays until si8900_latest_unlink
+ *
+ *  args:
+ *      si8900_latest* t : handle
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_latest_close(&table);
+ */
+void si8900_latest_close(si8900_latest* t)
+{
+    if (t->hdr)
+    {
+        munmap(t->hdr, t->map_len);
+        t->hdr = NULL;
+    }
+}
+
+
+/*
+ *  name: si8900_latest_unlink
+ *
+ *  desc: removes a table name, mapped handles stay valid until closed
+ *
+ *  args:
+ *      const char* name : shared memory name
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_latest_unlink("/si8900_latest");
+ */
+void si8900_latest_unlink(const char* name)
+{
+    shm_unlink(name);
+}
+
+
+/*
+ *  name: si8900_latest_set
+ *
+ *  desc: overwrites the slot for a reading's device and channel
+ *
+ *  args:
+ *      si8900_latest* t        : writer handle
+ *      uint32_t dev            : device index, < n_dev
+ *      const si8900_reading* r : newest reading, r->inch picks the channel
+ *      uint32_t rms_q8         : current channel RMS in counts, Q8
+ *      si8900_tstamp tstamp    : time of the reading
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_latest_set(&table, 0, &readings[n - 1],
+ *                        si8900_bucket_rms_q8(&b, 1), now);
+ */
+void si8900_latest_set(si8900_latest* t, uint32_t dev, const si8900_reading* r, uint32_t rms_q8, si8900_tstamp tstamp)
+{
+    si8900_latest_slot* s;
+    uint32_t seq;
+
+    if (dev >= t->hdr->n_dev || r->inch >= SI8900_NUM_CH)
+    {
+        return;
+    }
+    s = &t->slot[dev * SI8900_NUM_CH + r->inch];
+    seq = s->seq; // single writer, no one else changes it
+
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // odd count lands before the data
+    s->val.tstamp = tstamp;
+    s->val.updates++;
+    s->val.rms_q8 = rms_q8;
+    s->val.reading = r->reading;
+    s->val.cmd_byte = r->cmd_byte;
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ *  name: si8900_latest_get
+ *
+ *  desc: takes a consistent snapshot of one slot. Gives up after
+ *        SI8900_LATEST_TRIES attempts so a writer that died inside the
+ *        slot (count left odd) can not hang its readers.
+ *
+ *  args:
+ *      const si8900_latest* t  : reader (or writer) handle
+ *      uint32_t dev            : device index
+ *      uint8_t ch              : channel
+ *      si8900_latest_val* out  : snapshot
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when out of range, the
+ *      slot has never been written or stayed busy for every attempt
+ *
+ *  example:
+ *      si8900_latest_val v;
+ *      if (!si8900_latest_get(&table, 0, 2, &v))
+ *      {
+ *          draw_meter(v.rms_q8, v.tstamp);
+ *      }
+ */
+uint8_t si8900_latest_get(const si8900_latest* t, uint32_t dev, uint8_t ch, si8900_latest_val* out)
+{
+    const si8900_latest_slot* s;
+    uint32_t seq, tries;
+
+    if (dev >= t->hdr->n_dev || ch >= SI8900_NUM_CH)
+    {
+        return FAILED;
+    }
+    s = &t->slot[dev * SI8900_NUM_CH + ch];
+    for (tries = 0; tries < SI8900_LATEST_TRIES; tries++)
+    {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue; // writer inside, it only holds the slot for a few stores
+        }
+        memcpy(out, &s->val, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // copy completes before the re-check
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return out->updates ? 0 : FAILED;
+        }
+    }
+    return FAILED;
+}
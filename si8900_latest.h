@@ -0,0 +1,101 @@
+/*
+ * si8900_latest.h
+ * seqlock protected "latest value" table in shared memory (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and POSIX shared memory (link -lrt on
+ *  older glibc).
+ *
+ *  One cache line per device and channel holds the newest reading, its
+ *  timestamp and the channel RMS. The acquisition process overwrites the
+ *  slots in place; dashboards poll at display rate. Readers take a
+ *  consistent snapshot without locks and never write to the mapping, so
+ *  any number of them costs the writer nothing and nothing queues.
+ *
+ *  Each slot has its own sequence count: odd while the writer is inside,
+ *  bumped to the next even value when done. A reader retries when it saw
+ *  an odd count or the count changed across its copy, at most
+ *  SI8900_LATEST_TRIES times: a writer killed between its two stores leaves
+ *  the count odd for good, and readers then get FAILED instead of spinning.
+ */
+
+#ifndef si8900_latest_H_
+#define si8900_latest_H_
+
+#ifndef PC_
+    #error "si8900_latest is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h", si8900_tstamp
+
+
+#define SI8900_LATEST_MAGIC   0x5339304CUL  // "S90L"
+#define SI8900_LATEST_VERSION 1
+
+#ifndef SI8900_LATEST_TRIES
+    #define SI8900_LATEST_TRIES     4096    // snapshot attempts before si8900_latest_get gives up
+#endif
+
+
+/*
+ * SNAPSHOT OF ONE CHANNEL
+ */
+typedef struct si8900_latest_val{
+    si8900_tstamp tstamp;   // time of 'reading'
+    uint32_t updates;       // times the slot was written, 0 = never
+    uint32_t rms_q8;        // channel RMS in counts, Q8
+    uint16_t reading;
+    si8900_cfg cmd_byte;
+}si8900_latest_val;
+
+
+/*
+ * SHARED SLOT -- one cache line per device and channel
+ */
+typedef struct si8900_latest_slot{
+    uint32_t seq;           // odd while being written
+    si8900_latest_val val;
+}SI8900_ALIGNED(SI8900_CACHE_LINE) si8900_latest_slot;
+
+
+/*
+ * SHARED HEADER -- slots follow at the next cache line
+ */
+typedef struct si8900_latest_hdr{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_dev;
+    uint32_t n_ch;          // SI8900_NUM_CH
+}SI8900_ALIGNED(SI8900_CACHE_LINE) si8900_latest_hdr;
+
+
+/*
+ * PROCESS LOCAL HANDLE
+ */
+typedef struct si8900_latest{
+    si8900_latest_hdr* hdr;
+    si8900_latest_slot* slot;   // slot[dev * SI8900_NUM_CH + ch]
+    size_t map_len;
+}si8900_latest;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_latest_create(si8900_latest*, const char*, uint32_t);
+uint8_t si8900_latest_open(si8900_latest*, const char*);
+void si8900_latest_close(si8900_latest*);
+void si8900_latest_unlink(const char*);
+void si8900_latest_set(si8900_latest*, uint32_t, const si8900_reading*, uint32_t, si8900_tstamp);
+uint8_t si8900_latest_get(const si8900_latest*, uint32_t, uint8_t, si8900_latest_val*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_latest_H_ */
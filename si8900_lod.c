@@ -0,0 +1,501 @@
+/*
+ * si8900_lod.c
+ * implementation file for the si8900 min/max level of detail pyramid.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_lod.h" // includes "si8900.h", <stdio.h>
+
+#include <stdlib.h>
+
+
+/*
+ *  name: si8900_lod_append
+ *
+ *  desc: appends a bucket to level k and merges finished pairs upwards
+ */
+static uint8_t si8900_lod_append(si8900_lod* l, uint8_t k, uint16_t mn, uint16_t mx)
+{
+    for (;;)
+    {
+        si8900_lod_level* lv = &l->level[k];
+        if (lv->len == lv->cap)
+        {
+            uint64_t cap = lv->cap ? lv->cap * 2 : 1024;
+            uint16_t* mm = (uint16_t*)realloc(lv->mm, (size_t)cap * 2 * sizeof(uint16_t));
+            if (!mm)
+            {
+                return FAILED;
+            }
+            lv->mm = mm;
+            lv->cap = cap;
+        }
+        lv->mm[2 * lv->len] = mn;
+        lv->mm[2 * lv->len + 1] = mx;
+        lv->len++;
+        if (k + 1 > l->n_levels)
+        {
+            l->n_levels = (uint8_t)(k + 1);
+        }
+
+        if ((lv->len & 1) || k + 1 >= SI8900_LOD_MAX_LEVELS)
+        {
+            return 0;
+        }
+        // pair complete, carry it up a level
+        if (lv->mm[2 * lv->len - 4] < mn)
+        {
+            mn = lv->mm[2 * lv->len - 4];
+        }
+        if (lv->mm[2 * lv->len - 3] > mx)
+        {
+            mx = lv->mm[2 * lv->len - 3];
+        }
+        k++;
+    }
+}
+
+
+/*
+ *  name: si8900_lod_expect
+ *
+ *  desc: level lengths push + finish build from a number of readings,
+ *        returns the number of levels
+ */
+static uint8_t si8900_lod_expect(uint64_t readings, uint8_t base_shift, uint64_t* len)
+{
+    uint8_t k, n_levels = 0;
+
+    // streaming: level 0 takes every (partial) bucket, each pair carries up
+    len[0] = (readings >> base_shift) + ((readings & ((1ULL << base_shift) - 1)) ? 1 : 0);
+    for (k = 1; k < SI8900_LOD_MAX_LEVELS; k++)
+    {
+        len[k] = len[k - 1] / 2;
+    }
+    // finish: an odd bucket goes up on its own, carrying like an append
+    for (k = 0; k + 1 < SI8900_LOD_MAX_LEVELS && len[k] > 1; k++)
+    {
+        uint8_t up = (uint8_t)(k + 1);
+        if (!(len[k] & 1))
+        {
+            continue;
+        }
+        for (;;)
+        {
+            len[up]++;
+            if ((len[up] & 1) || up + 1 >= SI8900_LOD_MAX_LEVELS)
+            {
+                break;
+            }
+            up++;
+        }
+    }
+    while (n_levels < SI8900_LOD_MAX_LEVELS && len[n_levels])
+    {
+        n_levels++;
+    }
+    return n_levels;
+}
+
+
+/*
+ *  name: si8900_lod_init
+ *
+ *  desc: sets up an empty pyramid
+ *
+ *  args:
+ *      si8900_lod* l      : pyramid to set up
+ *      uint8_t base_shift : log2 of the readings per level 0 bucket, eg: 4
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_lod lod;
+ *      si8900_lod_init(&lod, 4);
+ */
+void si8900_lod_init(si8900_lod* l, uint8_t base_shift)
+{
+    uint8_t k;
+    l->base_shift = base_shift;
+    l->n_levels = 0;
+    l->finished = 0;
+    l->readings = 0;
+    l->acc_min = 0xFFFFu;
+    l->acc_max = 0;
+    l->acc_n = 0;
+    for (k = 0; k < SI8900_LOD_MAX_LEVELS; k++)
+    {
+        l->level[k].mm = NULL;
+        l->level[k].len = 0;
+        l->level[k].cap = 0;
+    }
+}
+
+
+/*
+ *  name: si8900_lod_free
+ *
+ *  desc: releases the levels of a pyramid
+ *
+ *  args:
+ *      si8900_lod* l : pyramid
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_lod_free(&lod);
+ */
+void si8900_lod_free(si8900_lod* l)
+{
+    uint8_t k;
+    for (k = 0; k < SI8900_LOD_MAX_LEVELS; k++)
+    {
+        free(l->level[k].mm);
+    }
+    si8900_lod_init(l, l->base_shift);
+}
+
+
+/*
+ *  name: si8900_lod_push
+ *
+ *  desc: adds readings to the pyramid, in capture order
+ *
+ *  args:
+ *      si8900_lod* l       : pyramid
+ *      const uint16_t* in  : readings of one channel
+ *      size_t n            : number of readings
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when out of memory or
+ *      the pyramid was already finished
+ *
+ *  example:
+ *      si8900_lod_push(&lod, blk.reading[0], blk.count[0]);
+ */
+uint8_t si8900_lod_push(si8900_lod* l, const uint16_t* in, size_t n)
+{
+    uint32_t per = 1UL << l->base_shift;
+    size_t i;
+
+    if (l->finished)
+    {
+        return FAILED;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (in[i] < l->acc_min)
+        {
+            l->acc_min = in[i];
+        }
+        if (in[i] > l->acc_max)
+        {
+            l->acc_max = in[i];
+        }
+        if (++l->acc_n == per)
+        {
+            if (si8900_lod_append(l, 0, l->acc_min, l->acc_max))
+            {
+                return FAILED;
+            }
+            l->acc_min = 0xFFFFu;
+            l->acc_max = 0;
+            l->acc_n = 0;
+        }
+    }
+    l->readings += n;
+    return 0;
+}
+
+
+/*
+ *  name: si8900_lod_finish
+ *
+ *  desc: closes the partial buckets at the end of the capture so every
+ *        level covers all readings. No more readings can be pushed.
+ *
+ *  args:
+ *      si8900_lod* l : pyramid
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when out of memory
+ *
+ *  example:
+ *      si8900_lod_finish(&lod);
+ */
+uint8_t si8900_lod_finish(si8900_lod* l)
+{
+    uint8_t k;
+
+    if (l->finished)
+    {
+        return 0;
+    }
+    if (l->acc_n && si8900_lod_append(l, 0, l->acc_min, l->acc_max))
+    {
+        return FAILED;
+    }
+    // an odd bucket at the end of a level goes up on its own
+    for (k = 0; k + 1 < SI8900_LOD_MAX_LEVELS && l->level[k].len > 1; k++)
+    {
+        si8900_lod_level* lv = &l->level[k];
+        if ((lv->len & 1) && si8900_lod_append(l, (uint8_t)(k + 1), lv->mm[2 * lv->len - 2], lv->mm[2 * lv->len - 1]))
+        {
+            return FAILED;
+        }
+    }
+    l->finished = 1;
+    return 0;
+}
+
+
+/*
+ *  name: si8900_lod_query
+ *
+ *  desc: min/max envelope of n_cols equal columns over readings [a, b)
+ *
+ *  args:
+ *      const si8900_lod* l : finished pyramid
+ *      uint64_t a          : first reading of the range
+ *      uint64_t b          : one past the last reading of the range
+ *      uint32_t n_cols     : pixel columns
+ *      uint16_t* col_min   : n_cols minimums out
+ *      uint16_t* col_max   : n_cols maximums out, a column with no
+ *                            readings gets min 0xFFFF and max 0
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_lod_query(&lod, view_start, view_end, 1920, mins, maxs);
+ */
+void si8900_lod_query(const si8900_lod* l, uint64_t a, uint64_t b, uint32_t n_cols, uint16_t* col_min, uint16_t* col_max)
+{
+    uint64_t span = (b > a) ? b - a : 0;
+    uint32_t c;
+
+    if (b > l->readings)
+    {
+        b = l->readings;
+    }
+    for (c = 0; c < n_cols; c++)
+    {
+        uint64_t s = a + span * c / n_cols;
+        uint64_t e = a + span * (c + 1) / n_cols;
+        uint16_t mn = 0xFFFFu, mx = 0;
+
+        if (e > b)
+        {
+            e = b;
+        }
+        if (s < e && l->n_levels)
+        {
+            uint64_t lo = s >> l->base_shift;
+            uint64_t hi = (e - 1) >> l->base_shift;
+            uint8_t k = 0;
+
+            // cover [lo, hi] with whole buckets, climbing a level per step
+            while (lo <= hi && k < l->n_levels)
+            {
+                const uint16_t* mm = l->level[k].mm;
+                if (lo & 1)
+                {
+                    mn = (mm[2 * lo] < mn) ? mm[2 * lo] : mn;
+                    mx = (mm[2 * lo + 1] > mx) ? mm[2 * lo + 1] : mx;
+                    lo++;
+                }
+                if (lo <= hi && !(hi & 1))
+                {
+                    mn = (mm[2 * hi] < mn) ? mm[2 * hi] : mn;
+                    mx = (mm[2 * hi + 1] > mx) ? mm[2 * hi + 1] : mx;
+                    if (hi == 0)
+                    {
+                        break;
+                    }
+                    hi--;
+                }
+                if (lo > hi)
+                {
+                    break;
+                }
+                if (k + 1 >= l->n_levels)
+                {
+                    // top level, take what is left directly
+                    for (; lo <= hi; lo++)
+                    {
+                        mn = (mm[2 * lo] < mn) ? mm[2 * lo] : mn;
+                        mx = (mm[2 * lo + 1] > mx) ? mm[2 * lo + 1] : mx;
+                    }
+                    break;
+                }
+                lo >>= 1;
+                hi >>= 1;
+                k++;
+            }
+        }
+        col_min[c] = mn;
+        col_max[c] = mx;
+    }
+}
+
+
+/*
+ *  name: si8900_lod_save
+ *
+ *  desc: writes a finished pyramid to a file
+ *
+ *  args:
+ *      const si8900_lod* l : finished pyramid
+ *      FILE* f             : file open for binary writing
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a write error
+ *
+ *  example:
+ *      FILE* f = fopen("capture.s9l", "wb");
+ *      si8900_lod_save(&lod, f);
+ */
+uint8_t si8900_lod_save(const si8900_lod* l, FILE* f)
+{
+    uint8_t hdr[16] = {'S', '9', 'L', SI8900_LOD_VERSION, 0, 0, 0, 0};
+    uint8_t word[8];
+    uint8_t k, i;
+    uint64_t j;
+
+    hdr[4] = l->base_shift;
+    hdr[5] = l->n_levels;
+    for (i = 0; i < 8; i++)
+    {
+        hdr[8 + i] = (uint8_t)(l->readings >> (8 * i));
+    }
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+    {
+        return FAILED;
+    }
+    for (k = 0; k < l->n_levels; k++)
+    {
+        for (i = 0; i < 8; i++)
+        {
+            word[i] = (uint8_t)(l->level[k].len >> (8 * i));
+        }
+        if (fwrite(word, 1, 8, f) != 8)
+        {
+            return FAILED;
+        }
+    }
+    for (k = 0; k < l->n_levels; k++)
+    {
+        for (j = 0; j < 2 * l->level[k].len; j++)
+        {
+            word[0] = (uint8_t)(l->level[k].mm[j] & 0xFF);
+            word[1] = (uint8_t)(l->level[k].mm[j] >> 8);
+            if (fwrite(word, 1, 2, f) != 2)
+            {
+                return FAILED;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_lod_load
+ *
+ *  desc: reads a pyramid written by si8900_lod_save
+ *
+ *  args:
+ *      si8900_lod* l : pyramid to fill, must be empty (init or free)
+ *      FILE* f       : file open for binary reading
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a bad file or out of memory.
+ *      A file is bad when it is short, or when its level count or any
+ *      level length is not what readings and base_shift give.
+ *
+ *  example:
+ *      si8900_lod lod;
+ *      si8900_lod_init(&lod, 0);
+ *      if (si8900_lod_load(&lod, f)) { ... }
+ */
+uint8_t si8900_lod_load(si8900_lod* l, FILE* f)
+{
+    uint8_t hdr[16], word[8];
+    uint64_t expect[SI8900_LOD_MAX_LEVELS];
+    uint64_t readings = 0, total = 0;
+    long here, end;
+    uint8_t k, i;
+    uint64_t j;
+
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+        hdr[0] != 'S' || hdr[1] != '9' || hdr[2] != 'L' ||
+        hdr[3] != SI8900_LOD_VERSION || hdr[4] >= 32 || hdr[5] > SI8900_LOD_MAX_LEVELS)
+    {
+        return FAILED;
+    }
+    for (i = 0; i < 8; i++)
+    {
+        readings |= (uint64_t)hdr[8 + i] << (8 * i);
+    }
+    // the level count and every length follow from readings and base_shift
+    if (si8900_lod_expect(readings, hdr[4], expect) != hdr[5])
+    {
+        return FAILED;
+    }
+    for (k = 0; k < hdr[5]; k++)
+    {
+        uint64_t len = 0;
+        if (fread(word, 1, 8, f) != 8)
+        {
+            return FAILED;
+        }
+        for (i = 0; i < 8; i++)
+        {
+            len |= (uint64_t)word[i] << (8 * i);
+        }
+        if (len != expect[k] || len > SIZE_MAX / (2 * sizeof(uint16_t)))
+        {
+            return FAILED;
+        }
+        total += len;
+    }
+    // when the file can tell, it must hold all the buckets before any memory is taken
+    here = ftell(f);
+    if (here >= 0 && fseek(f, 0, SEEK_END) == 0)
+    {
+        end = ftell(f);
+        if (end < here || fseek(f, here, SEEK_SET) != 0 ||
+            (uint64_t)(end - here) / 4 < total)
+        {
+            return FAILED;
+        }
+    }
+
+    si8900_lod_init(l, hdr[4]);
+    l->n_levels = hdr[5];
+    l->readings = readings;
+    for (k = 0; k < l->n_levels; k++)
+    {
+        uint64_t len = expect[k];
+        l->level[k].mm = (uint16_t*)malloc((size_t)len * 2 * sizeof(uint16_t));
+        if (!l->level[k].mm)
+        {
+            si8900_lod_free(l);
+            return FAILED;
+        }
+        l->level[k].len = len;
+        l->level[k].cap = len;
+        for (j = 0; j < 2 * len; j++)
+        {
+            if (fread(word, 1, 2, f) != 2)
+            {
+                si8900_lod_free(l);
+                return FAILED;
+            }
+            l->level[k].mm[j] = (uint16_t)(word[0] | (word[1] << 8));
+        }
+    }
+    l->finished = 1;
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * si8900_lod.h
+ * min/max level of detail pyramid for visualising long si8900 captures (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option.
+ *
+ *  Level 0 holds the min/max of every 2^base_shift readings of one
+ *  channel, each level above halves the resolution again. The pyramid is
+ *  built in one streaming pass (amortised O(1) per reading) and takes
+ *  about 4 / 2^base_shift of the raw capture size.
+ *
+ *  si8900_lod_query fills N pixel columns for a reading range [a, b) by
+ *  covering every column with O(log) buckets from the levels, so it never
+ *  touches raw readings. Columns narrower than a level 0 bucket are
+ *  widened to level 0 resolution, the envelope stays conservative.
+ *
+ *  si8900_lod_save / si8900_lod_load store the pyramid in a file next to
+ *  the capture:
+ *      'S' '9' 'L' version(1) base_shift(1) n_levels(1) pad(2)
+ *      readings(8) len[n_levels](8 each) then min/max pairs(2 + 2) per level
+ *  all little endian.
+ */
+
+#ifndef si8900_lod_H_
+#define si8900_lod_H_
+
+#ifndef PC_
+    #error "si8900_lod is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+#include <stdio.h>
+
+
+#define SI8900_LOD_VERSION      1
+#define SI8900_LOD_MAX_LEVELS   48
+
+
+/*
+ * one level, mm[2i] is the min and mm[2i+1] the max of bucket i
+ */
+typedef struct si8900_lod_level{
+    uint16_t* mm;
+    uint64_t len;
+    uint64_t cap;
+}si8900_lod_level;
+
+
+/*
+ * PYRAMID
+ */
+typedef struct si8900_lod{
+    uint8_t base_shift;     // log2 of the readings in a level 0 bucket
+    uint8_t n_levels;       // levels in use
+    uint8_t finished;       // si8900_lod_finish was called
+    uint64_t readings;      // readings pushed
+    uint16_t acc_min;       // level 0 bucket being filled
+    uint16_t acc_max;
+    uint32_t acc_n;
+    si8900_lod_level level[SI8900_LOD_MAX_LEVELS];
+}si8900_lod;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_lod_init(si8900_lod*, uint8_t);
+void si8900_lod_free(si8900_lod*);
+uint8_t si8900_lod_push(si8900_lod*, const uint16_t*, size_t);
+uint8_t si8900_lod_finish(si8900_lod*);
+void si8900_lod_query(const si8900_lod*, uint64_t, uint64_t, uint32_t, uint16_t*, uint16_t*);
+uint8_t si8900_lod_save(const si8900_lod*, FILE*);
+uint8_t si8900_lod_load(si8900_lod*, FILE*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_lod_H_ */
@@ -0,0 +1,421 @@
+/*
+ * si8900_merge.c
+ * implementation file for the si8900 k-way merge.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_merge.h" // includes "si8900_block.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SI8900_MERGE_NEVER ((si8900_tstamp)~(si8900_tstamp)0) // empty queue key
+
+
+/*
+ *  name: si8900_merge_key
+ *
+ *  desc: time at the head of a stream, SI8900_MERGE_NEVER when empty or
+ *        for padding leaves
+ */
+static si8900_tstamp si8900_merge_key(const si8900_merge* m, uint32_t s)
+{
+    const si8900_merge_in* in;
+
+    if (s >= m->n)
+    {
+        return SI8900_MERGE_NEVER;
+    }
+    in = &m->in[s];
+    return (in->head == in->tail) ? SI8900_MERGE_NEVER : in->q[in->head & m->mask].tstamp;
+}
+
+
+/*
+ *  name: si8900_merge_beats
+ *
+ *  desc: stream a goes before stream b, ties go to the lower stream
+ */
+static uint8_t si8900_merge_beats(const si8900_merge* m, uint32_t a, uint32_t b)
+{
+    si8900_tstamp ka = si8900_merge_key(m, a), kb = si8900_merge_key(m, b);
+    return (ka < kb || (ka == kb && a < b)) ? 1 : 0;
+}
+
+
+/*
+ *  name: si8900_merge_build
+ *
+ *  desc: plays the whole tournament again, needed when a queue that was
+ *        empty got readings (its key dropped, which a replay can not fix)
+ */
+static void si8900_merge_build(si8900_merge* m)
+{
+    uint16_t* w = m->scratch;
+    uint32_t i;
+
+    for (i = 0; i < m->k; i++)
+    {
+        w[m->k + i] = (uint16_t)i;
+    }
+    for (i = m->k - 1; i >= 1; i--)
+    {
+        uint16_t a = w[2 * i], b = w[2 * i + 1];
+        if (si8900_merge_beats(m, a, b))
+        {
+            w[i] = a;
+            m->tree[i] = b;
+        }
+        else
+        {
+            w[i] = b;
+            m->tree[i] = a;
+        }
+    }
+    m->tree[0] = w[1];
+    m->dirty = 0;
+}
+
+
+/*
+ *  name: si8900_merge_replay
+ *
+ *  desc: replays the winner's path after its head moved on
+ */
+static void si8900_merge_replay(si8900_merge* m, uint32_t s)
+{
+    uint32_t node, winner = s;
+
+    for (node = (s + m->k) >> 1; node >= 1; node >>= 1)
+    {
+        uint32_t loser = m->tree[node];
+        if (si8900_merge_beats(m, loser, winner))
+        {
+            m->tree[node] = (uint16_t)winner;
+            winner = loser;
+        }
+    }
+    m->tree[0] = (uint16_t)winner;
+}
+
+
+/*
+ *  name: si8900_merge_bound
+ *
+ *  desc: earliest time an empty stream can still deliver
+ */
+static si8900_tstamp si8900_merge_bound(const si8900_merge* m, const si8900_merge_in* in)
+{
+    si8900_tstamp b = (m->newest > m->lateness) ? m->newest - m->lateness : 0;
+    return (in->seen && in->last > b) ? in->last : b;
+}
+
+
+/*
+ *  name: si8900_merge_take
+ *
+ *  desc: hands out readings in time order up to 'gate' (or all when final)
+ */
+static size_t si8900_merge_take(si8900_merge* m, si8900_merged* out, size_t cap, uint8_t final)
+{
+    si8900_tstamp gate = SI8900_MERGE_NEVER;
+    size_t count = 0;
+    uint32_t s;
+
+    if (m->dirty)
+    {
+        si8900_merge_build(m);
+    }
+    if (!final)
+    {
+        for (s = 0; s < m->n; s++)
+        {
+            if (m->in[s].head == m->in[s].tail)
+            {
+                si8900_tstamp b = si8900_merge_bound(m, &m->in[s]);
+                gate = (b < gate) ? b : gate;
+            }
+        }
+    }
+
+    while (count < cap)
+    {
+        si8900_merge_in* in;
+
+        s = m->tree[0];
+        if (s >= m->n)
+        {
+            break; // every queue is empty
+        }
+        in = &m->in[s];
+        if (in->head == in->tail || in->q[in->head & m->mask].tstamp > gate)
+        {
+            break;
+        }
+        out[count++] = in->q[in->head & m->mask];
+        in->head++;
+        if (in->head == in->tail && !final)
+        {
+            // this stream now holds the rest back too
+            si8900_tstamp b = si8900_merge_bound(m, in);
+            gate = (b < gate) ? b : gate;
+        }
+        si8900_merge_replay(m, s);
+    }
+
+    if (count)
+    {
+        m->released = out[count - 1].tstamp;
+        m->any_out = 1;
+    }
+    return count;
+}
+
+
+/*
+ *  name: si8900_merge_init
+ *
+ *  desc: sets up a merge of n streams
+ *
+ *  args:
+ *      si8900_merge* m         : merge to set up
+ *      uint32_t n              : streams, <= SI8900_MERGE_MAX_STREAMS
+ *      uint32_t cap            : queue length per stream, power of 2
+ *      si8900_tstamp lateness  : how far a stream may lag the newest
+ *                                reading of any stream
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on bad sizes or no memory
+ *
+ *  example:
+ *      si8900_merge m;
+ *      si8900_merge_init(&m, 3, 8192, 2000000); // 3 devices, 2 ms late at most
+ */
+uint8_t si8900_merge_init(si8900_merge* m, uint32_t n, uint32_t cap, si8900_tstamp lateness)
+{
+    uint32_t i;
+
+    memset(m, 0, sizeof(*m));
+    if (!n || n > SI8900_MERGE_MAX_STREAMS || !cap || (cap & (cap - 1)))
+    {
+        return FAILED;
+    }
+    m->k = 1;
+    while (m->k < n || m->k < 2)
+    {
+        m->k <<= 1;
+    }
+    m->n = n;
+    m->mask = cap - 1;
+    m->lateness = lateness;
+    m->tree = (uint16_t*)malloc(m->k * sizeof(uint16_t));
+    m->scratch = (uint16_t*)malloc(2 * m->k * sizeof(uint16_t));
+    m->in = (si8900_merge_in*)calloc(n, sizeof(si8900_merge_in));
+    if (!m->tree || !m->scratch || !m->in)
+    {
+        si8900_merge_free(m);
+        return FAILED;
+    }
+    for (i = 0; i < n; i++)
+    {
+        m->in[i].q = (si8900_merged*)malloc(cap * sizeof(si8900_merged));
+        if (!m->in[i].q)
+        {
+            si8900_merge_free(m);
+            return FAILED;
+        }
+    }
+    si8900_merge_build(m);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_merge_free
+ *
+ *  desc: frees the queues
+ *
+ *  args:
+ *      si8900_merge* m : merge
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_merge_free(&m);
+ */
+void si8900_merge_free(si8900_merge* m)
+{
+    uint32_t i;
+
+    if (m->in)
+    {
+        for (i = 0; i < m->n; i++)
+        {
+            free(m->in[i].q);
+        }
+    }
+    free(m->in);
+    free(m->tree);
+    free(m->scratch);
+    m->in = NULL;
+    m->tree = NULL;
+    m->scratch = NULL;
+}
+
+
+/*
+ *  name: si8900_merge_push
+ *
+ *  desc: queues timestamped readings of one stream
+ *
+ *  args:
+ *      si8900_merge* m           : merge
+ *      uint32_t s                : stream
+ *      const si8900_reading* r   : readings, in time order
+ *      const si8900_tstamp* t    : matching timestamps
+ *      size_t n                  : number of readings
+ *
+ *  return value:
+ *      size_t: readings taken, including late ones that were dropped.
+ *              Less than n when the queue is full -- pop, then push the rest.
+ *
+ *  example:
+ *      used = si8900_merge_push(&m, dev, readings, stamps, n);
+ */
+size_t si8900_merge_push(si8900_merge* m, uint32_t s, const si8900_reading* r, const si8900_tstamp* t, size_t n)
+{
+    si8900_merge_in* in;
+    size_t i;
+
+    if (s >= m->n)
+    {
+        return 0;
+    }
+    in = &m->in[s];
+    if (in->head == in->tail && n)
+    {
+        m->dirty = 1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        si8900_merged* e;
+
+        if ((m->any_out && t[i] < m->released) || (in->seen && t[i] < in->last))
+        {
+            in->late++;
+            continue;
+        }
+        if (in->tail - in->head > m->mask)
+        {
+            break;
+        }
+        e = &in->q[in->tail & m->mask];
+        e->tstamp = t[i];
+        e->stream = (uint16_t)s;
+        e->r = r[i];
+        in->tail++;
+        in->last = t[i];
+        in->seen = 1;
+        if (t[i] > m->newest)
+        {
+            m->newest = t[i];
+        }
+    }
+    return i;
+}
+
+
+#ifdef SI8900_TSTAMP_
+/*
+ *  name: si8900_merge_push_block
+ *
+ *  desc: queues a timestamped block, channel ch of device dev goes to
+ *        stream dev * SI8900_NUM_CH + ch. Readings that do not fit are
+ *        dropped and counted as late.
+ *
+ *  args:
+ *      si8900_merge* m          : merge with SI8900_NUM_CH streams per device
+ *      uint32_t dev             : device
+ *      const si8900_block* blk  : block with timestamps
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_merge_push_block(&m, dev, &blk);
+ */
+void si8900_merge_push_block(si8900_merge* m, uint32_t dev, const si8900_block* blk)
+{
+    si8900_reading r[SI8900_BLOCK_LEN];
+    uint32_t s;
+    uint16_t i;
+    size_t used;
+    uint8_t ch;
+
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        s = dev * SI8900_NUM_CH + ch;
+        if (s >= m->n)
+        {
+            return;
+        }
+        for (i = 0; i < blk->count[ch]; i++)
+        {
+            r[i].cmd_byte = blk->cmd_byte[ch];
+            r[i].inch = ch;
+            r[i].reading = blk->reading[ch][i];
+        }
+        used = si8900_merge_push(m, s, r, blk->tstamp[ch], blk->count[ch]);
+        m->in[s].late += blk->count[ch] - used;
+    }
+}
+#endif
+
+
+/*
+ *  name: si8900_merge_pop
+ *
+ *  desc: hands out the readings that can no longer be preceded by a
+ *        reading still to come, in time order
+ *
+ *  args:
+ *      si8900_merge* m      : merge
+ *      si8900_merged* out   : room for 'cap' readings
+ *      size_t cap           : batch size
+ *
+ *  return value:
+ *      size_t: readings written to 'out'
+ *
+ *  example:
+ *      while ((n = si8900_merge_pop(&m, batch, 4096)) != 0)
+ *      {
+ *          analyse(batch, n);
+ *      }
+ */
+size_t si8900_merge_pop(si8900_merge* m, si8900_merged* out, size_t cap)
+{
+    return si8900_merge_take(m, out, cap, 0);
+}
+
+
+/*
+ *  name: si8900_merge_flush
+ *
+ *  desc: hands out queued readings in time order without waiting for
+ *        lagging streams, for the end of a capture
+ *
+ *  args:
+ *      si8900_merge* m      : merge
+ *      si8900_merged* out   : room for 'cap' readings
+ *      size_t cap           : batch size
+ *
+ *  return value:
+ *      size_t: readings written to 'out'
+ *
+ *  example:
+ *      while ((n = si8900_merge_flush(&m, batch, 4096)) != 0) { ... }
+ */
+size_t si8900_merge_flush(si8900_merge* m, si8900_merged* out, size_t cap)
+{
+    return si8900_merge_take(m, out, cap, 1);
+}
@@ -0,0 +1,98 @@
+/*
+ * si8900_merge.h
+ * time ordered k-way merge of timestamped si8900 reading streams (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option.
+ *
+ *  Every input stream (a device, or a device channel) pushes readings in
+ *  time order into its own queue. si8900_merge_pop hands out the readings
+ *  of all streams in one time ordered sequence, picking the earliest
+ *  queue head with a tournament (loser) tree: log2(streams) comparisons
+ *  per reading, on a tree that fits in a cache line or two.
+ *
+ *  A stream with an empty queue may still deliver earlier readings, so
+ *  output waits for it -- but no longer than the lateness bound: once the
+ *  newest time pushed by any stream is 'lateness' past a reading, that
+ *  reading is released. Readings that show up after their time has been
+ *  released (or out of order within their stream) are dropped and
+ *  counted per stream. si8900_merge_flush releases everything at the end
+ *  of a capture.
+ */
+
+#ifndef si8900_merge_H_
+#define si8900_merge_H_
+
+#ifndef PC_
+    #error "si8900_merge is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h", si8900_tstamp
+
+
+#define SI8900_MERGE_MAX_STREAMS 256
+
+
+/*
+ * MERGED READING
+ */
+typedef struct si8900_merged{
+    si8900_tstamp tstamp;
+    uint16_t stream;
+    si8900_reading r;
+}si8900_merged;
+
+
+/*
+ * INPUT STREAM
+ */
+typedef struct si8900_merge_in{
+    si8900_merged* q;       // queue, 'cap' entries
+    uint32_t head;
+    uint32_t tail;
+    si8900_tstamp last;     // newest time accepted
+    uint8_t seen;           // any reading accepted yet
+    uint64_t late;          // readings dropped
+}si8900_merge_in;
+
+
+/*
+ * MERGE
+ */
+typedef struct si8900_merge{
+    uint32_t n;             // streams
+    uint32_t k;             // leaves, power of 2 >= n
+    uint32_t mask;          // queue capacity - 1
+    uint8_t dirty;          // a queue went from empty to non empty
+    si8900_tstamp lateness;
+    si8900_tstamp newest;   // newest time pushed by any stream
+    si8900_tstamp released; // time of the last reading handed out
+    uint8_t any_out;
+    uint16_t* tree;         // tree[0] winner, tree[1 .. k-1] losers
+    uint16_t* scratch;      // 2 * k, for rebuilding
+    si8900_merge_in* in;
+}si8900_merge;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_merge_init(si8900_merge*, uint32_t, uint32_t, si8900_tstamp);
+void si8900_merge_free(si8900_merge*);
+size_t si8900_merge_push(si8900_merge*, uint32_t, const si8900_reading*, const si8900_tstamp*, size_t);
+#ifdef SI8900_TSTAMP_
+void si8900_merge_push_block(si8900_merge*, uint32_t, const si8900_block*);
+#endif
+size_t si8900_merge_pop(si8900_merge*, si8900_merged*, size_t);
+size_t si8900_merge_flush(si8900_merge*, si8900_merged*, size_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_merge_H_ */
@@ -0,0 +1,189 @@
+/*
+ * si8900_notify.c
+ * implementation file for si8900 batch notification.
+ * Author: Danyal Ahsanullah
+ */
+#define _GNU_SOURCE // eventfd, timerfd and epoll are linux only
+
+#include "si8900_notify.h" // includes "si8900.h"
+
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+/*
+ *  name: si8900_notify_init
+ *
+ *  desc: creates the notification fd
+ *
+ *  args:
+ *      si8900_notify* n        : notifier to set up
+ *      uint32_t threshold      : readings that make fd readable, >= 1
+ *      uint32_t max_latency_us : longest a reading waits before fd turns
+ *                                readable anyway, 0 for no bound
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a system error
+ *
+ *  example:
+ *      si8900_notify note;
+ *      si8900_notify_init(&note, 4096, 20000); // 4096 readings or 20 ms
+ *      ev.events = EPOLLIN;
+ *      epoll_ctl(app_epfd, EPOLL_CTL_ADD, note.fd, &ev);
+ */
+uint8_t si8900_notify_init(si8900_notify* n, uint32_t threshold, uint32_t max_latency_us)
+{
+    struct epoll_event ev;
+
+    n->threshold = threshold ? threshold : 1;
+    n->max_latency_us = max_latency_us;
+    n->pending = 0;
+    n->timer_fd = -1;
+    n->event_fd = -1;
+
+    n->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (n->fd < 0)
+    {
+        return FAILED;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+
+    n->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (n->event_fd < 0 || epoll_ctl(n->fd, EPOLL_CTL_ADD, n->event_fd, &ev) != 0)
+    {
+        si8900_notify_close(n);
+        return FAILED;
+    }
+    if (max_latency_us)
+    {
+        n->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (n->timer_fd < 0 || epoll_ctl(n->fd, EPOLL_CTL_ADD, n->timer_fd, &ev) != 0)
+        {
+            si8900_notify_close(n);
+            return FAILED;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_notify_close
+ *
+ *  desc: closes every fd of the notifier
+ *
+ *  args:
+ *      si8900_notify* n : notifier
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_notify_close(&note);
+ */
+void si8900_notify_close(si8900_notify* n)
+{
+    if (n->timer_fd >= 0)
+    {
+        close(n->timer_fd);
+        n->timer_fd = -1;
+    }
+    if (n->event_fd >= 0)
+    {
+        close(n->event_fd);
+        n->event_fd = -1;
+    }
+    if (n->fd >= 0)
+    {
+        close(n->fd);
+        n->fd = -1;
+    }
+}
+
+
+/*
+ *  name: si8900_notify_add
+ *
+ *  desc: producer side, reports newly available readings
+ *
+ *  args:
+ *      si8900_notify* n : notifier
+ *      uint32_t count   : readings made available
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_ring_publish(&ring, readings, cnt);
+ *      si8900_notify_add(&note, cnt);
+ */
+void si8900_notify_add(si8900_notify* n, uint32_t count)
+{
+    uint32_t old;
+
+    if (!count)
+    {
+        return;
+    }
+    old = __atomic_fetch_add(&n->pending, count, __ATOMIC_ACQ_REL);
+
+    if (old == 0 && n->timer_fd >= 0)
+    {
+        // first reading of a batch starts the latency clock
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = n->max_latency_us / 1000000;
+        its.it_value.tv_nsec = (long)(n->max_latency_us % 1000000) * 1000;
+        timerfd_settime(n->timer_fd, 0, &its, NULL);
+    }
+    if (old < n->threshold && old + count >= n->threshold)
+    {
+        uint64_t one = 1;
+        ssize_t w = write(n->event_fd, &one, sizeof(one));
+        (void)w; // only fails when the counter is saturated, still readable
+    }
+}
+
+
+/*
+ *  name: si8900_notify_ack
+ *
+ *  desc: consumer side, call after fd turned readable. Clears fd and
+ *        takes the pending count; the next batch starts from zero.
+ *
+ *  args:
+ *      si8900_notify* n : notifier
+ *
+ *  return value:
+ *      uint32_t: readings reported since the previous ack (may be 0)
+ *
+ *  example:
+ *      if (ev.data.fd == note.fd)
+ *      {
+ *          avail = si8900_notify_ack(&note);
+ *          while ((cnt = si8900_ring_read(&ring, readings, &lost)) != 0) { ... }
+ *      }
+ */
+uint32_t si8900_notify_ack(si8900_notify* n)
+{
+    uint64_t drain;
+    ssize_t r;
+
+    // disarm and drain before taking the count: a batch the producer
+    // starts after the exchange below re-arms both on its own
+    if (n->timer_fd >= 0)
+    {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        timerfd_settime(n->timer_fd, 0, &its, NULL);
+        r = read(n->timer_fd, &drain, sizeof(drain));
+    }
+    r = read(n->event_fd, &drain, sizeof(drain));
+    (void)r; // EAGAIN when that source did not fire
+
+    return __atomic_exchange_n(&n->pending, 0, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,63 @@
+/*
+ * si8900_notify.h
+ * pollable batch notification for si8900 consumers (host only, linux).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and linux (eventfd, timerfd, epoll).
+ *
+ *  The acquisition side reports how many readings it made available with
+ *  si8900_notify_add; the consumer adds 'fd' to its own poll/epoll loop.
+ *  fd turns readable once 'threshold' readings are pending, or
+ *  'max_latency_us' after the first reading of a batch arrived, whichever
+ *  comes first. The consumer then calls si8900_notify_ack to take the
+ *  pending count and re-arm. Larger thresholds mean fewer wakeups, the
+ *  latency bound caps how long a slow trickle waits.
+ *
+ *  Internally fd is an epoll set over an eventfd (threshold) and a timerfd
+ *  (latency). The producer only makes a syscall when a batch starts (to
+ *  arm the timer) and when it crosses the threshold, not per reading.
+ *  One producer thread and one consumer thread may use it concurrently.
+ *  A wakeup can occasionally find nothing pending, ack then returns 0.
+ */
+
+#ifndef si8900_notify_H_
+#define si8900_notify_H_
+
+#ifndef PC_
+    #error "si8900_notify is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+/*
+ * NOTIFIER
+ */
+typedef struct si8900_notify{
+    int fd;                     // poll this one for POLLIN / EPOLLIN
+    int event_fd;
+    int timer_fd;               // -1 without a latency bound
+    uint32_t threshold;         // readings per wakeup
+    uint32_t max_latency_us;    // 0 = wait for the threshold only
+    uint32_t pending;           // readings added since the last ack
+}si8900_notify;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_notify_init(si8900_notify*, uint32_t, uint32_t);
+void si8900_notify_close(si8900_notify*);
+void si8900_notify_add(si8900_notify*, uint32_t);
+uint32_t si8900_notify_ack(si8900_notify*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_notify_H_ */
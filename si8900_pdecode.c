@@ -0,0 +1,253 @@
+/*
+ * si8900_pdecode.c
+ * implementation file for the si8900 parallel capture decoder.
+ * Author: Danyal Ahsanullah
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include "si8900_pdecode.h" // includes "si8900.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+/*
+ * PER CHUNK STATE
+ */
+typedef struct si8900_pdec_chunk{
+    const uint8_t* in;
+    size_t len;             // whole capture, frames may run past 'end'
+    size_t begin;
+    size_t end;             // frames starting before here belong to the chunk
+    si8900_reading* out;    // pass 2 destination, NULL in pass 1
+    size_t entry;           // where the walk starts
+    size_t count;           // frames found
+    size_t exit;            // where the walk left the chunk
+    size_t n_spec;
+    size_t spec[SI8900_PDEC_SPEC];
+}si8900_pdec_chunk;
+
+
+/*
+ *  name: si8900_pdec_walk
+ *
+ *  desc: si8900_decode_frames' walk over the frames starting in
+ *        [pos, end). Writes readings to 'out' when given and notes the
+ *        first positions in 'spec' when given.
+ *
+ *  return value:
+ *      size_t: frames found, *exit set to where the walk stopped
+ */
+static size_t si8900_pdec_walk(const uint8_t* in, size_t len, size_t pos, size_t end, si8900_reading* out, size_t* spec, size_t* n_spec, size_t* exit)
+{
+    size_t count = 0;
+
+    while (pos < end && pos + SI8900_FRAME_LEN <= len)
+    {
+        if (!IS_FRAME(in + pos))
+        {
+            pos++; // not aligned on a frame, resync on next byte
+            continue;
+        }
+        if (out)
+        {
+            out[count].cmd_byte = in[pos];
+            out[count].inch = GET_INCH(in[pos + 1]);
+            out[count].reading = GET_READING(PACKET_JOIN(in[pos + 1], in[pos + 2]));
+        }
+        if (spec && *n_spec < SI8900_PDEC_SPEC)
+        {
+            spec[(*n_spec)++] = pos;
+        }
+        count++;
+        pos += SI8900_FRAME_LEN;
+    }
+    *exit = pos;
+    return count;
+}
+
+
+/*
+ *  name: si8900_pdec_worker
+ *
+ *  desc: walks one chunk from its entry, pass 1 or pass 2
+ */
+static void* si8900_pdec_worker(void* arg)
+{
+    si8900_pdec_chunk* c = (si8900_pdec_chunk*)arg;
+    size_t exit;
+
+    if (c->out)
+    {
+        si8900_pdec_walk(c->in, c->len, c->entry, c->end, c->out, NULL, NULL, &exit);
+    }
+    else
+    {
+        c->n_spec = 0;
+        c->count = si8900_pdec_walk(c->in, c->len, c->begin, c->end, NULL, c->spec, &c->n_spec, &c->exit);
+    }
+    return NULL;
+}
+
+
+/*
+ *  name: si8900_pdec_resolve
+ *
+ *  desc: frames and exit of a chunk for its real entry, reusing pass 1
+ *        once the walk joins the one pass 1 took
+ */
+static void si8900_pdec_resolve(si8900_pdec_chunk* c, size_t entry)
+{
+    size_t pos = entry, count = 0, j = 0;
+
+    c->entry = entry;
+    if (entry == c->begin)
+    {
+        return; // pass 1 already walked from here
+    }
+    while (pos < c->end && pos + SI8900_FRAME_LEN <= c->len)
+    {
+        if (!IS_FRAME(c->in + pos))
+        {
+            pos++;
+            continue;
+        }
+        while (j < c->n_spec && c->spec[j] < pos)
+        {
+            j++;
+        }
+        if (j < c->n_spec && c->spec[j] == pos)
+        {
+            // same offset, same walk from here on
+            c->count = count + (c->count - j);
+            return;
+        }
+        count++;
+        pos += SI8900_FRAME_LEN;
+    }
+    // never joined, this walk is the whole answer
+    c->count = count;
+    c->exit = pos;
+}
+
+
+/*
+ *  name: si8900_pdec_run
+ *
+ *  desc: runs the worker over every chunk, the calling thread takes the
+ *        first one. Falls back to the calling thread if a thread fails.
+ */
+static void si8900_pdec_run(si8900_pdec_chunk* c, uint32_t n)
+{
+    pthread_t tids[SI8900_PDEC_MAX_THREADS];
+    uint8_t started[SI8900_PDEC_MAX_THREADS];
+    uint32_t t;
+
+    for (t = 1; t < n; t++)
+    {
+        started[t] = (pthread_create(&tids[t], NULL, si8900_pdec_worker, &c[t]) == 0);
+    }
+    si8900_pdec_worker(&c[0]);
+    for (t = 1; t < n; t++)
+    {
+        if (started[t])
+        {
+            pthread_join(tids[t], NULL);
+        }
+        else
+        {
+            si8900_pdec_worker(&c[t]);
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_decode_parallel
+ *
+ *  desc: decodes a whole raw capture in parallel. The result is identical
+ *        to si8900_decode_frames(in, len, out, len / SI8900_FRAME_LEN, consumed).
+ *
+ *  args:
+ *      const uint8_t* in      : raw bytes received from the si8900
+ *      size_t len             : number of bytes in 'in'
+ *      si8900_reading* out    : room for len / SI8900_FRAME_LEN readings
+ *      size_t* consumed       : set to the number of bytes of 'in' used up,
+ *                               may be NULL
+ *      uint32_t threads       : worker threads, 0 for one per online core
+ *
+ *  return value:
+ *      size_t: number of readings written to 'out'
+ *
+ *  example:
+ *      si8900_reading* r = malloc(cap_len / SI8900_FRAME_LEN * sizeof(si8900_reading));
+ *      size_t n = si8900_decode_parallel(cap, cap_len, r, NULL, 0);
+ */
+size_t si8900_decode_parallel(const uint8_t* in, size_t len, si8900_reading* out, size_t* consumed, uint32_t threads)
+{
+    si8900_pdec_chunk* c;
+    size_t pos, total = 0;
+    uint32_t t;
+
+    if (!threads)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0) ? (uint32_t)cores : 1;
+    }
+    if (threads > SI8900_PDEC_MAX_THREADS)
+    {
+        threads = SI8900_PDEC_MAX_THREADS;
+    }
+    if ((size_t)threads > len / SI8900_PDEC_MIN_CHUNK)
+    {
+        threads = (uint32_t)(len / SI8900_PDEC_MIN_CHUNK);
+    }
+    if (threads < 2 || (c = (si8900_pdec_chunk*)malloc(threads * sizeof(si8900_pdec_chunk))) == NULL)
+    {
+        return si8900_decode_frames(in, len, out, len / SI8900_FRAME_LEN, consumed);
+    }
+
+    // pass 1: every chunk walked from its own start
+    for (t = 0; t < threads; t++)
+    {
+        c[t].in = in;
+        c[t].len = len;
+        c[t].begin = len / threads * t;
+        c[t].end = (t == threads - 1) ? len : len / threads * (t + 1);
+        c[t].out = NULL;
+    }
+    si8900_pdec_run(c, threads);
+
+    // stitch: real entries in order, which fixes each chunk's place in out
+    pos = 0;
+    for (t = 0; t < threads; t++)
+    {
+        if (pos >= c[t].end)
+        {
+            // a frame or resync ran clean over this chunk
+            c[t].entry = pos;
+            c[t].count = 0;
+            c[t].exit = pos;
+        }
+        else
+        {
+            si8900_pdec_resolve(&c[t], pos);
+        }
+        c[t].out = out + total;
+        total += c[t].count;
+        pos = c[t].exit;
+    }
+
+    // pass 2: decode straight into place
+    si8900_pdec_run(c, threads);
+    free(c);
+
+    if (consumed)
+    {
+        // as si8900_decode_frames: a full 'out' stops right after the last
+        // frame, otherwise the trailing bytes are checked for a partial one
+        *consumed = (total == len / SI8900_FRAME_LEN) ? pos : si8900_sync_frame(in, len, pos);
+    }
+    return total;
+}
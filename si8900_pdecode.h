@@ -0,0 +1,55 @@
+/*
+ * si8900_pdecode.h
+ * parallel decoder for large raw si8900 captures (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and pthreads.
+ *
+ *  Gives exactly the readings and 'consumed' of si8900_decode_frames over
+ *  the whole capture, using one thread per chunk of the input.
+ *
+ *  The sequential decoder is a walk whose only state is the byte offset,
+ *  so chunk k's result depends only on where the walk enters it. Pass 1
+ *  has every thread walk its chunk from the chunk start, counting frames
+ *  and noting where the first SI8900_PDEC_SPEC frames sit. The real
+ *  entry of chunk k -- where chunk k-1's walk left off, usually inside a
+ *  frame straddling the boundary -- is then resolved in order: walking
+ *  from it, the first frame that matches a noted position means the two
+ *  walks have joined and the rest of pass 1's count holds. On a clean
+ *  stream that takes one frame. Pass 2 decodes every chunk again from its
+ *  real entry straight into its final place in 'out', so no scratch
+ *  buffers and no copying are needed.
+ */
+
+#ifndef si8900_pdecode_H_
+#define si8900_pdecode_H_
+
+#ifndef PC_
+    #error "si8900_pdecode is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+#define SI8900_PDEC_SPEC      16            // frame positions noted per chunk
+#ifndef SI8900_PDEC_MIN_CHUNK
+    #define SI8900_PDEC_MIN_CHUNK (1UL << 20) // smallest chunk worth a thread
+#endif
+#define SI8900_PDEC_MAX_THREADS 256
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+size_t si8900_decode_parallel(const uint8_t*, size_t, si8900_reading*, size_t*, uint32_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_pdecode_H_ */
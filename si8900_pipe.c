@@ -0,0 +1,399 @@
+/*
+ * si8900_pipe.c
+ * implementation file for the si8900 processing pipeline.
+ * Author: Danyal Ahsanullah
+ */
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include "si8900_pipe.h" // includes "si8900_block.h", <pthread.h>
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/*
+ *  name: si8900_pipe_now
+ *
+ *  desc: monotonic time in ns
+ */
+static uint64_t si8900_pipe_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/*
+ *  name: si8900_pipe_upstream
+ *
+ *  desc: blocks available to a stage, the least any of its upstreams finished
+ */
+static uint64_t si8900_pipe_upstream(const si8900_pipe* p, uint32_t upstream)
+{
+    uint64_t avail = UINT64_MAX;
+    uint32_t i;
+
+    if (upstream == SI8900_PIPE_PRODUCER)
+    {
+        return __atomic_load_n(&p->cursor, __ATOMIC_ACQUIRE);
+    }
+    for (i = 0; upstream; i++, upstream >>= 1)
+    {
+        if (upstream & 1)
+        {
+            uint64_t s = __atomic_load_n(&p->stage[i].seq, __ATOMIC_ACQUIRE);
+            if (s < avail)
+            {
+                avail = s;
+            }
+        }
+    }
+    return avail;
+}
+
+
+/*
+ *  name: si8900_pipe_worker
+ *
+ *  desc: stage thread, processes batches of blocks until stopped and drained
+ */
+static void* si8900_pipe_worker(void* arg)
+{
+    si8900_pipe_stage* st = (si8900_pipe_stage*)arg;
+    si8900_pipe* p = st->pipe;
+    uint64_t next = st->seq;
+    uint32_t idle = 0;
+
+#ifdef __linux__
+    if (st->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(st->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // best effort
+    }
+#endif
+
+    for (;;)
+    {
+        uint64_t avail = si8900_pipe_upstream(p, st->upstream);
+        uint64_t s;
+
+        if (avail == next)
+        {
+            if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE) &&
+                next == __atomic_load_n(&p->cursor, __ATOMIC_ACQUIRE))
+            {
+                break; // producer is done and so is everything upstream
+            }
+            if (++idle >= SI8900_PIPE_SPIN)
+            {
+                sched_yield();
+                idle = 0;
+            }
+            continue;
+        }
+        idle = 0;
+
+        for (s = next; s < avail; s++)
+        {
+            si8900_block* blk = &p->ring[s & p->mask];
+            uint64_t t0 = si8900_pipe_now(), t1, lat;
+            uint32_t readings = 0;
+            uint8_t ch;
+
+            st->fn(blk, s, st->ctx);
+            t1 = si8900_pipe_now();
+            lat = t1 - p->t_pub[s & p->mask];
+
+            // counters are read by other threads, keep each store whole
+            __atomic_store_n(&st->stats.busy_ns, st->stats.busy_ns + (t1 - t0), __ATOMIC_RELAXED);
+            __atomic_store_n(&st->stats.lat_sum_ns, st->stats.lat_sum_ns + lat, __ATOMIC_RELAXED);
+            if (lat > st->stats.lat_max_ns)
+            {
+                __atomic_store_n(&st->stats.lat_max_ns, lat, __ATOMIC_RELAXED);
+            }
+            for (ch = 0; ch < SI8900_NUM_CH; ch++)
+            {
+                readings += blk->count[ch];
+            }
+            __atomic_store_n(&st->stats.readings, st->stats.readings + readings, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&st->stats.blocks, avail, __ATOMIC_RELAXED);
+        __atomic_store_n(&st->seq, avail, __ATOMIC_RELEASE);
+        next = avail;
+    }
+    return NULL;
+}
+
+
+/*
+ *  name: si8900_pipe_init
+ *
+ *  desc: allocates the block ring, no stages yet
+ *
+ *  args:
+ *      si8900_pipe* p : pipeline to set up
+ *      uint32_t size  : blocks in the ring, power of 2
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a bad size or no memory
+ *
+ *  example:
+ *      si8900_pipe pipe;
+ *      si8900_pipe_init(&pipe, 64);
+ */
+uint8_t si8900_pipe_init(si8900_pipe* p, uint32_t size)
+{
+    void* mem = NULL;
+
+    memset(p, 0, sizeof(*p));
+    if (!size || (size & (size - 1)))
+    {
+        return FAILED;
+    }
+    if (posix_memalign(&mem, SI8900_CACHE_LINE, size * sizeof(si8900_block)) != 0)
+    {
+        return FAILED;
+    }
+    p->ring = (si8900_block*)mem;
+    p->t_pub = (uint64_t*)calloc(size, sizeof(uint64_t));
+    if (!p->t_pub)
+    {
+        si8900_pipe_free(p);
+        return FAILED;
+    }
+    p->mask = size - 1;
+    return 0;
+}
+
+
+/*
+ *  name: si8900_pipe_free
+ *
+ *  desc: releases the ring, stop the pipeline first
+ *
+ *  args:
+ *      si8900_pipe* p : pipeline
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_pipe_free(&pipe);
+ */
+void si8900_pipe_free(si8900_pipe* p)
+{
+    free(p->ring);
+    free(p->t_pub);
+    p->ring = NULL;
+    p->t_pub = NULL;
+}
+
+
+/*
+ *  name: si8900_pipe_add
+ *
+ *  desc: appends a stage, call before si8900_pipe_start
+ *
+ *  args:
+ *      si8900_pipe* p     : pipeline
+ *      si8900_pipe_fn fn  : per block callback
+ *      void* ctx          : passed to fn
+ *      uint32_t upstream  : SI8900_PIPE_STAGE(i) of every earlier stage to
+ *                           wait for, or SI8900_PIPE_PRODUCER
+ *      int cpu            : core to pin the stage thread to, -1 for none
+ *
+ *  return value:
+ *      int: stage index, or -1 when full or upstream names a stage that is
+ *      not an earlier one
+ *
+ *  example:
+ *      int filt = si8900_pipe_add(&pipe, filter_fn, &cic, SI8900_PIPE_PRODUCER, -1);
+ *      si8900_pipe_add(&pipe, sink_fn, log_file, SI8900_PIPE_STAGE(filt), -1);
+ */
+int si8900_pipe_add(si8900_pipe* p, si8900_pipe_fn fn, void* ctx, uint32_t upstream, int cpu)
+{
+    si8900_pipe_stage* st;
+
+    if (p->n_stages >= SI8900_PIPE_MAX_STAGES || (upstream >> p->n_stages) || !fn)
+    {
+        return -1;
+    }
+    st = &p->stage[p->n_stages];
+    memset(st, 0, sizeof(*st));
+    st->fn = fn;
+    st->ctx = ctx;
+    st->upstream = upstream;
+    st->cpu = cpu;
+    st->pipe = p;
+    return (int)p->n_stages++;
+}
+
+
+/*
+ *  name: si8900_pipe_start
+ *
+ *  desc: starts one thread per stage
+ *
+ *  args:
+ *      si8900_pipe* p : pipeline with its stages added
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED if a thread could not be
+ *      created (the ones already running are stopped again)
+ *
+ *  example:
+ *      si8900_pipe_start(&pipe);
+ */
+uint8_t si8900_pipe_start(si8900_pipe* p)
+{
+    uint32_t i;
+
+    p->stop = 0;
+    for (i = 0; i < p->n_stages; i++)
+    {
+        if (pthread_create(&p->stage[i].tid, NULL, si8900_pipe_worker, &p->stage[i]) != 0)
+        {
+            uint32_t started = i;
+            __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+            for (i = 0; i < started; i++)
+            {
+                pthread_join(p->stage[i].tid, NULL);
+            }
+            return FAILED;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_pipe_stop
+ *
+ *  desc: lets every stage finish the blocks already published, then joins
+ *        the stage threads. Call from the producer thread.
+ *
+ *  args:
+ *      si8900_pipe* p : running pipeline
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_pipe_stop(&pipe);
+ */
+void si8900_pipe_stop(si8900_pipe* p)
+{
+    uint32_t i;
+
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < p->n_stages; i++)
+    {
+        pthread_join(p->stage[i].tid, NULL);
+    }
+}
+
+
+/*
+ *  name: si8900_pipe_claim
+ *
+ *  desc: producer side, waits for a free block and returns it reset.
+ *        Every claim must be followed by si8900_pipe_publish.
+ *
+ *  args:
+ *      si8900_pipe* p : running pipeline
+ *
+ *  return value:
+ *      si8900_block*: block to fill
+ *
+ *  example:
+ *      si8900_block* blk = si8900_pipe_claim(&pipe);
+ */
+si8900_block* si8900_pipe_claim(si8900_pipe* p)
+{
+    uint64_t seq = p->claimed;
+    uint32_t i, idle = 0;
+    si8900_block* blk;
+
+    // the slot is free once every stage is past its previous lap
+    while (seq - p->gate > p->mask)
+    {
+        uint64_t slowest = seq;
+
+        for (i = 0; i < p->n_stages; i++)
+        {
+            uint64_t s = __atomic_load_n(&p->stage[i].seq, __ATOMIC_ACQUIRE);
+            if (s < slowest)
+            {
+                slowest = s;
+            }
+        }
+        p->gate = slowest;
+        if (seq - p->gate > p->mask && ++idle >= SI8900_PIPE_SPIN)
+        {
+            sched_yield();
+            idle = 0;
+        }
+    }
+
+    blk = &p->ring[seq & p->mask];
+    si8900_block_reset(blk);
+    p->claimed = seq + 1;
+    return blk;
+}
+
+
+/*
+ *  name: si8900_pipe_publish
+ *
+ *  desc: producer side, hands the claimed block to the stages
+ *
+ *  args:
+ *      si8900_pipe* p : running pipeline
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_decode_block(rx_buf, rx_len, blk, &used);
+ *      si8900_pipe_publish(&pipe);
+ */
+void si8900_pipe_publish(si8900_pipe* p)
+{
+    p->t_pub[(p->claimed - 1) & p->mask] = si8900_pipe_now();
+    __atomic_store_n(&p->cursor, p->claimed, __ATOMIC_RELEASE);
+}
+
+
+/*
+ *  name: si8900_pipe_stats_get
+ *
+ *  desc: copies a stage's counters. Safe while running, the fields are
+ *        each current but not a single snapshot.
+ *
+ *  args:
+ *      const si8900_pipe* p      : pipeline
+ *      uint32_t i                : stage index
+ *      si8900_pipe_stats* out    : counters
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_pipe_stats_get(&pipe, 0, &st);
+ *      printf("%.1f us avg\n", st.lat_sum_ns / 1e3 / st.blocks);
+ */
+void si8900_pipe_stats_get(const si8900_pipe* p, uint32_t i, si8900_pipe_stats* out)
+{
+    const si8900_pipe_stats* s = &p->stage[i].stats;
+
+    out->blocks = __atomic_load_n(&s->blocks, __ATOMIC_RELAXED);
+    out->readings = __atomic_load_n(&s->readings, __ATOMIC_RELAXED);
+    out->busy_ns = __atomic_load_n(&s->busy_ns, __ATOMIC_RELAXED);
+    out->lat_sum_ns = __atomic_load_n(&s->lat_sum_ns, __ATOMIC_RELAXED);
+    out->lat_max_ns = __atomic_load_n(&s->lat_max_ns, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,135 @@
+/*
+ * si8900_pipe.h
+ * multi stage processing pipeline over a shared ring of si8900 blocks (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and pthreads.
+ *
+ *  One preallocated ring of si8900_block is shared by every stage; blocks
+ *  are never copied. The producer (usually the decoder) claims a block,
+ *  fills it and publishes it. Every stage runs on its own thread and owns
+ *  a sequence: the number of blocks it has finished. A stage may work on
+ *  a block once all of its upstreams -- the producer, or a set of earlier
+ *  stages -- have finished it, and it processes everything available in
+ *  one batch before publishing its own sequence once. Stages sharing an
+ *  upstream run side by side on the same blocks (eg: RMS and event
+ *  detection both after the filter), so they may only read the block, or
+ *  edit fields no sibling touches. A stage gated on several stages (a
+ *  join, see SI8900_PIPE_STAGE) sees the in place edits of all of them.
+ *  The producer waits while the slowest stage is a full ring behind,
+ *  which is the pipeline's backpressure.
+ *
+ *  Stages spin briefly on their barrier then yield. For the lowest
+ *  latency give each stage its own core ('cpu' in si8900_pipe_add).
+ *
+ *  Per stage counters (blocks, readings, time spent in the stage and the
+ *  publish to done latency of each block) can be read at any time with
+ *  si8900_pipe_stats_get.
+ *
+ *  example:
+ *      si8900_pipe pipe;
+ *      si8900_pipe_init(&pipe, 64);
+ *      f = si8900_pipe_add(&pipe, filter_fn, &cic, SI8900_PIPE_PRODUCER, 1);
+ *      r = si8900_pipe_add(&pipe, rms_fn, &agg, SI8900_PIPE_STAGE(f), 2);
+ *      e = si8900_pipe_add(&pipe, event_fn, &ev, SI8900_PIPE_STAGE(f), 3);
+ *      si8900_pipe_add(&pipe, log_fn, log_file, SI8900_PIPE_STAGE(r) | SI8900_PIPE_STAGE(e), -1);
+ *      si8900_pipe_start(&pipe);
+ *      while (running)
+ *      {
+ *          si8900_block* blk = si8900_pipe_claim(&pipe);
+ *          si8900_decode_block(rx_buf, rx_len, blk, &used);
+ *          si8900_pipe_publish(&pipe);
+ *      }
+ *      si8900_pipe_stop(&pipe);
+ *      si8900_pipe_free(&pipe);
+ */
+
+#ifndef si8900_pipe_H_
+#define si8900_pipe_H_
+
+#ifndef PC_
+    #error "si8900_pipe is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h"
+
+#include <pthread.h>
+
+
+#define SI8900_PIPE_MAX_STAGES 8
+#define SI8900_PIPE_PRODUCER   0UL  // upstream of first stages
+#define SI8900_PIPE_STAGE(i)  (1UL << (i))  // upstream set bit of stage i
+#define SI8900_PIPE_SPIN       256  // empty polls before yielding
+
+
+/*
+ * STAGE CALLBACK -- called once per block, in sequence order
+ */
+typedef void (*si8900_pipe_fn)(si8900_block* blk, uint64_t seq, void* ctx);
+
+
+/*
+ * STAGE COUNTERS
+ */
+typedef struct si8900_pipe_stats{
+    uint64_t blocks;
+    uint64_t readings;
+    uint64_t busy_ns;           // time spent inside the callback
+    uint64_t lat_sum_ns;        // publish -> done, summed over blocks
+    uint64_t lat_max_ns;
+}si8900_pipe_stats;
+
+
+/*
+ * STAGE -- own cache line for the hot sequence
+ */
+typedef struct si8900_pipe_stage{
+    uint64_t seq SI8900_ALIGNED(SI8900_CACHE_LINE); // blocks finished
+    si8900_pipe_stats stats;
+    si8900_pipe_fn fn;
+    void* ctx;
+    uint32_t upstream;          // SI8900_PIPE_STAGE bits or SI8900_PIPE_PRODUCER
+    int cpu;                    // core to pin to, -1 for none
+    pthread_t tid;
+    struct si8900_pipe* pipe;
+}si8900_pipe_stage;
+
+
+/*
+ * PIPELINE
+ */
+typedef struct si8900_pipe{
+    uint64_t cursor SI8900_ALIGNED(SI8900_CACHE_LINE); // blocks published
+    uint64_t claimed;           // producer only
+    uint64_t gate;              // producer only, cached slowest stage
+    uint8_t stop;
+    uint32_t n_stages;
+    uint32_t mask;              // ring size - 1
+    si8900_block* ring;
+    uint64_t* t_pub;            // publish time of each ring slot, ns
+    si8900_pipe_stage stage[SI8900_PIPE_MAX_STAGES];
+}si8900_pipe;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_pipe_init(si8900_pipe*, uint32_t);
+void si8900_pipe_free(si8900_pipe*);
+int si8900_pipe_add(si8900_pipe*, si8900_pipe_fn, void*, uint32_t, int);
+uint8_t si8900_pipe_start(si8900_pipe*);
+void si8900_pipe_stop(si8900_pipe*);
+si8900_block* si8900_pipe_claim(si8900_pipe*);
+void si8900_pipe_publish(si8900_pipe*);
+void si8900_pipe_stats_get(const si8900_pipe*, uint32_t, si8900_pipe_stats*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_pipe_H_ */
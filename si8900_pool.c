@@ -0,0 +1,515 @@
+/*
+ * si8900_pool.c
+ * implementation file for the si8900 work stealing analytics pool.
+ * Author: Danyal Ahsanullah
+ */
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include "si8900_pool.h" // includes "si8900_block.h", <pthread.h>
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SI8900_POOL_DEV_MASK (SI8900_POOL_DEV_QUEUE - 1)
+
+
+/*
+ *  name: si8900_pool_push
+ *
+ *  desc: owner pushes a device on the bottom of its deque
+ */
+static void si8900_pool_push(si8900_pool_worker* w, uint32_t d)
+{
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&w->deque[b & w->mask], d, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ *  name: si8900_pool_pop
+ *
+ *  desc: owner takes the newest device, -1 when empty
+ */
+static int32_t si8900_pool_pop(si8900_pool_worker* w)
+{
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t t;
+    int32_t d = -1;
+
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    if (t <= b)
+    {
+        d = (int32_t)__atomic_load_n(&w->deque[b & w->mask], __ATOMIC_RELAXED);
+        if (t == b)
+        {
+            // last one, race the thieves for it
+            if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            {
+                d = -1;
+            }
+            __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+    {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return d;
+}
+
+
+/*
+ *  name: si8900_pool_steal
+ *
+ *  desc: another worker takes the oldest device, -1 when empty or lost a race
+ */
+static int32_t si8900_pool_steal(si8900_pool_worker* w)
+{
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    int64_t b;
+    int32_t d;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+    {
+        return -1;
+    }
+    d = (int32_t)__atomic_load_n(&w->deque[t & w->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        return -1;
+    }
+    return d;
+}
+
+
+/*
+ *  name: si8900_pool_take_inbox
+ *
+ *  desc: empties a worker's inbox into the deque of 'self',
+ *        returns one device to run now or -1
+ */
+static int32_t si8900_pool_take_inbox(si8900_pool* p, si8900_pool_worker* self, si8900_pool_worker* from)
+{
+    int32_t d, next, first;
+
+    if (__atomic_load_n(&from->inbox, __ATOMIC_RELAXED) < 0)
+    {
+        return -1;
+    }
+    first = __atomic_exchange_n(&from->inbox, -1, __ATOMIC_ACQUIRE);
+    if (first < 0)
+    {
+        return -1;
+    }
+    for (d = p->dev[first].next; d >= 0; d = next)
+    {
+        // once pushed d can be stolen, run and queued again, rewriting next
+        next = p->dev[d].next;
+        si8900_pool_push(self, (uint32_t)d);
+    }
+    return first;
+}
+
+
+/*
+ *  name: si8900_pool_wake
+ *
+ *  desc: wakes a parked worker if there is one
+ */
+static void si8900_pool_wake(si8900_pool* p)
+{
+    if (__atomic_load_n(&p->sleepers, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_signal(&p->wake);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+
+/*
+ *  name: si8900_pool_has_work
+ *
+ *  desc: any device waiting in an inbox or deque
+ */
+static uint8_t si8900_pool_has_work(si8900_pool* p)
+{
+    uint32_t i;
+
+    for (i = 0; i < p->n_workers; i++)
+    {
+        si8900_pool_worker* w = &p->worker[i];
+        if (__atomic_load_n(&w->inbox, __ATOMIC_SEQ_CST) >= 0 ||
+            __atomic_load_n(&w->top, __ATOMIC_SEQ_CST) < __atomic_load_n(&w->bottom, __ATOMIC_SEQ_CST))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_pool_run_dev
+ *
+ *  desc: runs up to SI8900_POOL_BUDGET tasks of a device in order, then
+ *        either releases the device or puts it back on the own deque
+ */
+static void si8900_pool_run_dev(si8900_pool* p, si8900_pool_worker* w, uint32_t d)
+{
+    si8900_pool_dev* dev = &p->dev[d];
+    uint32_t head = dev->head, tail, n;
+
+    for (n = 0; n < SI8900_POOL_BUDGET; n++)
+    {
+        si8900_pool_task task;
+
+        tail = __atomic_load_n(&dev->tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            break;
+        }
+        task = dev->task[head & SI8900_POOL_DEV_MASK];
+        task.fn(d, task.arg);
+        head++;
+        __atomic_store_n(&dev->head, head, __ATOMIC_RELEASE); // frees the slot
+        __atomic_sub_fetch(&p->pending, 1, __ATOMIC_RELEASE);
+        w->tasks++;
+    }
+
+    if (head != __atomic_load_n(&dev->tail, __ATOMIC_ACQUIRE))
+    {
+        si8900_pool_push(w, d); // still busy, idle workers may steal it
+        si8900_pool_wake(p);
+        return;
+    }
+    __atomic_store_n(&dev->scheduled, 0, __ATOMIC_SEQ_CST);
+    // a submit between the check above and the release saw scheduled == 1
+    // and left the device to us, take it back if nobody else did
+    if (head != __atomic_load_n(&dev->tail, __ATOMIC_SEQ_CST) &&
+        !__atomic_exchange_n(&dev->scheduled, 1, __ATOMIC_SEQ_CST))
+    {
+        si8900_pool_push(w, d);
+    }
+}
+
+
+/*
+ *  name: si8900_pool_worker_main
+ *
+ *  desc: worker thread
+ */
+static void* si8900_pool_worker_main(void* arg)
+{
+    si8900_pool_worker* w = (si8900_pool_worker*)arg;
+    si8900_pool* p = w->pool;
+    uint32_t idle = 0, k;
+
+#ifdef __linux__
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // best effort
+    }
+#endif
+
+    for (;;)
+    {
+        int32_t d = si8900_pool_pop(w);
+
+        if (d < 0)
+        {
+            d = si8900_pool_take_inbox(p, w, w);
+        }
+        for (k = 1; d < 0 && k < p->n_workers; k++)
+        {
+            // start at a random victim so thieves spread out
+            si8900_pool_worker* v;
+            w->rng = w->rng * 1103515245u + 12345u;
+            v = &p->worker[(w->id + 1 + (w->rng >> 16) % (p->n_workers - 1)) % p->n_workers];
+            d = si8900_pool_steal(v);
+            if (d < 0)
+            {
+                d = si8900_pool_take_inbox(p, w, v);
+            }
+            if (d >= 0)
+            {
+                w->steals++;
+            }
+        }
+
+        if (d >= 0)
+        {
+            idle = 0;
+            si8900_pool_run_dev(p, w, (uint32_t)d);
+            continue;
+        }
+        if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        if (++idle < SI8900_POOL_SPIN)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // park, submitters signal when they see a sleeper
+        pthread_mutex_lock(&p->lock);
+        __atomic_add_fetch(&p->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (!si8900_pool_has_work(p) && !__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE))
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10000000; // 10 ms backstop
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&p->wake, &p->lock, &ts);
+        }
+        __atomic_sub_fetch(&p->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&p->lock);
+        idle = 0;
+    }
+    return NULL;
+}
+
+
+/*
+ *  name: si8900_pool_unwind
+ *
+ *  desc: stops and joins the first 'started' workers and frees the pool
+ */
+static void si8900_pool_unwind(si8900_pool* p, uint32_t started)
+{
+    uint32_t i;
+
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(p->worker[i].tid, NULL);
+    }
+    for (i = 0; i < p->n_workers; i++)
+    {
+        free(p->worker[i].deque);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    free(p->worker);
+    free(p->dev);
+    p->worker = NULL;
+    p->dev = NULL;
+    p->n_workers = 0;
+}
+
+
+/*
+ *  name: si8900_pool_init
+ *
+ *  desc: allocates the devices and starts the workers
+ *
+ *  args:
+ *      si8900_pool* p     : pool to set up
+ *      uint32_t n_workers : worker threads, 0 for one per online core
+ *      uint32_t n_devs    : devices, tasks are submitted per device index
+ *      uint8_t pin        : 1 to pin worker i to core i (mod cores)
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on no memory or threads
+ *
+ *  example:
+ *      si8900_pool pool;
+ *      si8900_pool_init(&pool, 0, 48, 1);
+ */
+uint8_t si8900_pool_init(si8900_pool* p, uint32_t n_workers, uint32_t n_devs, uint8_t pin)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t cap = 1, i;
+    void* mem = NULL;
+
+    memset(p, 0, sizeof(*p));
+    if (cores < 1)
+    {
+        cores = 1;
+    }
+    if (!n_workers)
+    {
+        n_workers = (uint32_t)cores;
+    }
+    if (!n_devs)
+    {
+        return FAILED;
+    }
+    while (cap < n_devs)
+    {
+        cap <<= 1;
+    }
+
+    if (posix_memalign(&mem, SI8900_CACHE_LINE, n_devs * sizeof(si8900_pool_dev)) != 0)
+    {
+        return FAILED;
+    }
+    p->dev = (si8900_pool_dev*)mem;
+    memset(p->dev, 0, n_devs * sizeof(si8900_pool_dev));
+    mem = NULL;
+    if (posix_memalign(&mem, SI8900_CACHE_LINE, n_workers * sizeof(si8900_pool_worker)) != 0)
+    {
+        free(p->dev);
+        p->dev = NULL;
+        return FAILED;
+    }
+    p->worker = (si8900_pool_worker*)mem;
+    memset(p->worker, 0, n_workers * sizeof(si8900_pool_worker));
+    p->n_devs = n_devs;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+
+    p->n_workers = n_workers;
+    for (i = 0; i < n_workers; i++)
+    {
+        si8900_pool_worker* w = &p->worker[i];
+        w->deque = (uint32_t*)malloc(cap * sizeof(uint32_t));
+        w->mask = cap - 1;
+        w->inbox = -1;
+        w->rng = 0x9E3779B9u * (i + 1);
+        w->cpu = pin ? (int)(i % (uint32_t)cores) : -1;
+        w->id = i;
+        w->pool = p;
+        if (!w->deque)
+        {
+            si8900_pool_unwind(p, 0);
+            return FAILED;
+        }
+    }
+    // workers scan each other, start them once every deque exists
+    for (i = 0; i < n_workers; i++)
+    {
+        if (pthread_create(&p->worker[i].tid, NULL, si8900_pool_worker_main, &p->worker[i]) != 0)
+        {
+            si8900_pool_unwind(p, i);
+            return FAILED;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_pool_free
+ *
+ *  desc: stops and joins the workers and frees the pool. Tasks not yet
+ *        run are dropped, call si8900_pool_drain first to finish them.
+ *
+ *  args:
+ *      si8900_pool* p : pool
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_pool_drain(&pool);
+ *      si8900_pool_free(&pool);
+ */
+void si8900_pool_free(si8900_pool* p)
+{
+    si8900_pool_unwind(p, p->n_workers);
+}
+
+
+/*
+ *  name: si8900_pool_submit
+ *
+ *  desc: queues a task for a device. Each device must be fed by a single
+ *        thread at a time; different devices may be fed concurrently.
+ *
+ *  args:
+ *      si8900_pool* p     : pool
+ *      uint32_t dev       : device index, < n_devs
+ *      si8900_pool_fn fn  : task, called as fn(dev, arg)
+ *      void* arg          : task argument, eg: the block to analyse
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when the device already has
+ *      SI8900_POOL_DEV_QUEUE tasks waiting (back off and retry)
+ *
+ *  example:
+ *      while (si8900_pool_submit(&pool, dev, analyse_block, blk))
+ *      {
+ *          sched_yield();
+ *      }
+ */
+uint8_t si8900_pool_submit(si8900_pool* p, uint32_t dev, si8900_pool_fn fn, void* arg)
+{
+    si8900_pool_dev* d;
+    si8900_pool_worker* home;
+    uint32_t tail;
+    int32_t old;
+
+    if (dev >= p->n_devs)
+    {
+        return FAILED;
+    }
+    d = &p->dev[dev];
+    tail = d->tail;
+    if (tail - __atomic_load_n(&d->head, __ATOMIC_ACQUIRE) == SI8900_POOL_DEV_QUEUE)
+    {
+        return FAILED;
+    }
+    d->task[tail & SI8900_POOL_DEV_MASK].fn = fn;
+    d->task[tail & SI8900_POOL_DEV_MASK].arg = arg;
+    __atomic_add_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&d->scheduled, 1, __ATOMIC_SEQ_CST))
+    {
+        return 0; // already queued or running, the task will be picked up
+    }
+    home = &p->worker[dev % p->n_workers];
+    old = __atomic_load_n(&home->inbox, __ATOMIC_RELAXED);
+    do
+    {
+        d->next = old;
+    } while (!__atomic_compare_exchange_n(&home->inbox, &old, (int32_t)dev, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    si8900_pool_wake(p);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_pool_drain
+ *
+ *  desc: waits until every submitted task has finished
+ *
+ *  args:
+ *      si8900_pool* p : pool
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_pool_drain(&pool);
+ */
+void si8900_pool_drain(si8900_pool* p)
+{
+    while (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * si8900_pool.h
+ * work stealing thread pool for per device si8900 analytics (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and pthreads.
+ *
+ *  Tasks are submitted per device and run in submission order for that
+ *  device, never two at once, so a task may keep device state (filters,
+ *  trackers, ...) without locking. Different devices run in parallel.
+ *
+ *  Each device has a small task queue filled by one submitting thread.
+ *  A device with queued tasks is scheduled as a whole: it sits in exactly
+ *  one place -- a worker inbox, a worker deque, or running on a worker.
+ *  Submissions go to the inbox of the device's home worker
+ *  (dev % n_workers). Workers run devices from their own deque (newest
+ *  first) and, when out of work, steal the oldest device from another
+ *  worker's deque or take another worker's inbox. A busy device keeps
+ *  its worker for up to SI8900_POOL_BUDGET tasks before going back on
+ *  the deque, where idle workers can pick it up. No lock is taken on
+ *  the submit or run paths; a mutex and condition variable are only used
+ *  to park workers that ran out of work.
+ *
+ *  Deques are fixed size Chase-Lev deques. A device is in at most one
+ *  deque at a time, so a capacity of n_devs never overflows.
+ */
+
+#ifndef si8900_pool_H_
+#define si8900_pool_H_
+
+#ifndef PC_
+    #error "si8900_pool is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h", SI8900_ALIGNED
+
+#include <pthread.h>
+
+
+#ifndef SI8900_POOL_DEV_QUEUE
+    #define SI8900_POOL_DEV_QUEUE 64  // tasks queued per device, power of 2
+#endif
+#define SI8900_POOL_BUDGET 16         // tasks per device turn
+#define SI8900_POOL_SPIN   64         // empty scans before parking
+
+
+/*
+ * TASK CALLBACK
+ */
+typedef void (*si8900_pool_fn)(uint32_t dev, void* arg);
+
+
+typedef struct si8900_pool_task{
+    si8900_pool_fn fn;
+    void* arg;
+}si8900_pool_task;
+
+
+/*
+ * DEVICE -- task queue plus scheduling state
+ */
+typedef struct si8900_pool_dev{
+    uint32_t head SI8900_ALIGNED(SI8900_CACHE_LINE);    // next task to run
+    uint32_t tail SI8900_ALIGNED(SI8900_CACHE_LINE);    // next free task slot
+    uint32_t scheduled;     // 1 while in an inbox, a deque or running
+    int32_t next;           // inbox link
+    si8900_pool_task task[SI8900_POOL_DEV_QUEUE];
+}si8900_pool_dev;
+
+
+/*
+ * WORKER
+ */
+typedef struct si8900_pool_worker{
+    int64_t top SI8900_ALIGNED(SI8900_CACHE_LINE);      // thieves take here
+    int64_t bottom SI8900_ALIGNED(SI8900_CACHE_LINE);   // owner end
+    int32_t inbox;          // submitted devices, -1 when empty
+    uint32_t* deque;
+    uint32_t mask;
+    uint32_t rng;
+    uint64_t tasks;         // tasks run
+    uint64_t steals;        // devices taken from other workers
+    int cpu;
+    uint32_t id;
+    pthread_t tid;
+    struct si8900_pool* pool;
+}si8900_pool_worker;
+
+
+/*
+ * POOL
+ */
+typedef struct si8900_pool{
+    uint64_t pending SI8900_ALIGNED(SI8900_CACHE_LINE); // submitted, not finished
+    uint32_t sleepers;
+    uint8_t stop;
+    uint32_t n_workers;
+    uint32_t n_devs;
+    si8900_pool_worker* worker;
+    si8900_pool_dev* dev;
+    pthread_mutex_t lock;   // parking only
+    pthread_cond_t wake;
+}si8900_pool;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_pool_init(si8900_pool*, uint32_t, uint32_t, uint8_t);
+void si8900_pool_free(si8900_pool*);
+uint8_t si8900_pool_submit(si8900_pool*, uint32_t, si8900_pool_fn, void*);
+void si8900_pool_drain(si8900_pool*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_pool_H_ */
@@ -0,0 +1,271 @@
+/*
+ * si8900_power.c
+ * implementation file for si8900 power and energy accumulation.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_power.h" // includes "si8900_freq.h", "si8900_convert.h"
+
+#include <math.h>
+
+#define SI8900_PI   3.14159265358979323846
+
+
+/*
+ *  name: si8900_power_scale
+ *
+ *  desc: converts a product of two Q4 AC values to watts (var, VA)
+ */
+static double si8900_power_scale(const si8900_power* p)
+{
+    return si8900_lsb_volts(p->v_cmd) * p->v_cal.scale *
+           si8900_lsb_volts(p->i_cmd) * p->i_cal.scale / 256.0;
+}
+
+
+/*
+ *  name: si8900_power_add
+ *
+ *  desc: adds to an energy counter, sticking at the top instead of wrapping
+ */
+static void si8900_power_add(uint64_t* e, uint64_t d)
+{
+    *e = (*e > UINT64_MAX - d) ? UINT64_MAX : *e + d;
+}
+
+
+/*
+ *  name: si8900_power_cycle
+ *
+ *  desc: turns the sums of one mains cycle into results and energy
+ */
+static void si8900_power_cycle(si8900_power* p)
+{
+    double n = (double)p->n;
+    double k = si8900_power_scale(p);
+    double step = 2.0 * SI8900_PI * (double)p->freq.freq_mhz / (double)p->fs_mhz;
+    double skew = (double)p->skew_q8 / 256.0;
+    // amplitude the skew interpolation leaves on the fundamental
+    double re = 1.0 - skew + skew * cos(step);
+    double im = skew * sin(step);
+    double interp_gain = sqrt(re * re + im * im);
+    double p_raw = (double)p->sum_vi / interp_gain;
+    double q_raw = -(double)p->sum_idv / (2.0 * sin(step / 2.0));
+    double s_raw = sqrt((double)p->sum_vv * (double)p->sum_ii);
+    // each reading pair lasts 1000 / fs_mhz seconds, counters are in uJ
+    double dt_uj = 1.0e9 / (double)p->fs_mhz;
+    int64_t whole;
+
+    p->v_rms = sqrt((double)p->sum_vv / n) * si8900_lsb_volts(p->v_cmd) * p->v_cal.scale / 16.0;
+    p->i_rms = sqrt((double)p->sum_ii / n) * si8900_lsb_volts(p->i_cmd) * p->i_cal.scale / 16.0;
+    p->p_w = p_raw / n * k;
+    p->q_var = q_raw / n * k;
+    p->s_va = s_raw / n * k;
+    p->pf = (s_raw > 0.0) ? p_raw / s_raw : 0.0;
+
+    // energy of this cycle, scaled with the command and calibration in force
+    // now, so a later PGA/REF change does not rescale what was counted before
+    p_raw = p_raw * k * dt_uj + p->e_carry_p;
+    whole = (int64_t)p_raw;
+    if (whole >= 0)
+    {
+        si8900_power_add(&p->e_import, (uint64_t)whole);
+    }
+    else
+    {
+        si8900_power_add(&p->e_export, (uint64_t)(-whole));
+    }
+    p->e_carry_p = p_raw - (double)whole;
+
+    q_raw = q_raw * k * dt_uj + p->e_carry_q;
+    whole = (int64_t)q_raw;
+    if (whole >= 0)
+    {
+        p->e_reactive = (p->e_reactive > INT64_MAX - whole) ? INT64_MAX : p->e_reactive + whole;
+    }
+    else
+    {
+        p->e_reactive = (p->e_reactive < INT64_MIN - whole) ? INT64_MIN : p->e_reactive + whole;
+    }
+    p->e_carry_q = q_raw - (double)whole;
+
+    s_raw = s_raw * k * dt_uj + p->e_carry_s;
+    whole = (int64_t)s_raw;
+    si8900_power_add(&p->e_apparent, (uint64_t)whole);
+    p->e_carry_s = s_raw - (double)whole;
+}
+
+
+/*
+ *  name: si8900_power_reset_cycle
+ *
+ *  desc: clears the per cycle sums
+ */
+static void si8900_power_reset_cycle(si8900_power* p)
+{
+    p->sum_vi = 0;
+    p->sum_vv = 0;
+    p->sum_ii = 0;
+    p->sum_idv = 0;
+    p->n = 0;
+}
+
+
+/*
+ *  name: si8900_power_init
+ *
+ *  desc: sets up a power engine. Energy counters start at zero.
+ *
+ *  args:
+ *      si8900_power* p              : engine to set up
+ *      uint8_t v_inch               : channel number (0-2) of the voltage
+ *      uint8_t i_inch               : channel number (0-2) of the current
+ *      uint32_t fs_mhz              : reading pair rate, in millihertz
+ *      int16_t skew_q8              : current sampling instant between voltage
+ *                                     readings, 0-256, 128 for alternating V/I
+ *      const si8900_conv_cal* v_cal : voltage channel calibration (to volts)
+ *      const si8900_conv_cal* i_cal : current channel calibration (to amps)
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_conv_cal v_cal = SI8900_CAL_MAINS;
+ *      si8900_conv_cal i_cal = {20.0, 0.0}; // 20 A per volt shunt amp
+ *      si8900_power pwr;
+ *      si8900_power_init(&pwr, 0, 1, 1000000, 128, &v_cal, &i_cal);
+ */
+void si8900_power_init(si8900_power* p, uint8_t v_inch, uint8_t i_inch, uint32_t fs_mhz, int16_t skew_q8,
+                       const si8900_conv_cal* v_cal, const si8900_conv_cal* i_cal)
+{
+    p->v_inch = v_inch;
+    p->i_inch = i_inch;
+    p->skew_q8 = skew_q8;
+    p->fs_mhz = fs_mhz;
+    p->v_cal = *v_cal;
+    p->i_cal = *i_cal;
+    p->v_cmd = GP_SINGLE_READ_0;
+    p->i_cmd = GP_SINGLE_READ_1;
+
+    si8900_freq_init(&p->freq, fs_mhz, 1, 8);
+    p->i_dc_q8 = (int32_t)(SI8900_RES / 2) << 8;
+    p->v_prev_q4 = 0;
+    p->i_pend_q4 = 0;
+    p->have_v = 0;
+    p->have_i = 0;
+    si8900_power_reset_cycle(p);
+
+    p->v_rms = 0.0;
+    p->i_rms = 0.0;
+    p->p_w = 0.0;
+    p->q_var = 0.0;
+    p->s_va = 0.0;
+    p->pf = 0.0;
+
+    p->e_import = 0;
+    p->e_export = 0;
+    p->e_reactive = 0;
+    p->e_apparent = 0;
+    p->e_carry_p = 0.0;
+    p->e_carry_q = 0.0;
+    p->e_carry_s = 0.0;
+}
+
+
+/*
+ *  name: si8900_power_update
+ *
+ *  desc: feeds one decoded reading to the power engine. Readings of
+ *        channels other than the voltage and current ones are ignored.
+ *
+ *  args:
+ *      si8900_power* p         : engine
+ *      const si8900_reading* r : next reading, in the order received
+ *
+ *  return value:
+ *      uint8_t: 1 when a mains cycle completed and the results were updated
+ *
+ *  example:
+ *      for (i = 0; i < n; i++)
+ *      {
+ *          if (si8900_power_update(&pwr, &readings[i]))
+ *          {
+ *              show(pwr.p_w, pwr.q_var, pwr.pf);
+ *          }
+ *      }
+ */
+uint8_t si8900_power_update(si8900_power* p, const si8900_reading* r)
+{
+    if (r->inch == p->i_inch)
+    {
+        int32_t x_q8 = (int32_t)r->reading << 8;
+        p->i_dc_q8 += (x_q8 - p->i_dc_q8) >> SI8900_FREQ_DC_SHIFT;
+        p->i_pend_q4 = (x_q8 - p->i_dc_q8) >> 4;
+        p->i_cmd = r->cmd_byte;
+        p->have_i = 1;
+        return 0;
+    }
+
+    if (r->inch == p->v_inch)
+    {
+        uint8_t was_started = p->freq.started;
+        uint8_t cycle_done = si8900_freq_update(&p->freq, r->reading);
+        int32_t v_q4 = (((int32_t)r->reading << 8) - p->freq.dc_q8) >> 4;
+
+        p->v_cmd = r->cmd_byte;
+        if (p->have_v && p->have_i)
+        {
+            int32_t dv = v_q4 - p->v_prev_q4;
+            int32_t v_at_i = p->v_prev_q4 + ((dv * p->skew_q8) >> 8);
+            p->sum_vi += (int64_t)v_at_i * p->i_pend_q4;
+            p->sum_vv += (uint64_t)((int64_t)v_q4 * v_q4);
+            p->sum_ii += (uint64_t)((int64_t)p->i_pend_q4 * p->i_pend_q4);
+            p->sum_idv += (int64_t)dv * p->i_pend_q4;
+            p->n++;
+            p->have_i = 0;
+        }
+        p->v_prev_q4 = v_q4;
+        p->have_v = 1;
+
+        if (!was_started && p->freq.started)
+        {
+            si8900_power_reset_cycle(p); // first crossing, drop the partial cycle
+        }
+        else if (cycle_done && p->n)
+        {
+            si8900_power_cycle(p);
+            si8900_power_reset_cycle(p);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_power_energy_wh
+ *
+ *  desc: converts one of the energy counters to watt (var, VA) hours
+ *
+ *  args:
+ *      const si8900_power* p : engine
+ *      uint8_t which         : SI8900_ENERGY_IMPORT, SI8900_ENERGY_EXPORT,
+ *                              SI8900_ENERGY_REACTIVE or SI8900_ENERGY_APPARENT
+ *
+ *  return value:
+ *      double: energy in Wh (varh, VAh)
+ *
+ *  example:
+ *      double kwh = si8900_power_energy_wh(&pwr, SI8900_ENERGY_IMPORT) / 1000.0;
+ */
+double si8900_power_energy_wh(const si8900_power* p, uint8_t which)
+{
+    double uj;
+    switch (which)
+    {
+    case SI8900_ENERGY_IMPORT:   uj = (double)p->e_import;   break;
+    case SI8900_ENERGY_EXPORT:   uj = (double)p->e_export;   break;
+    case SI8900_ENERGY_REACTIVE: uj = (double)p->e_reactive; break;
+    default:                     uj = (double)p->e_apparent; break;
+    }
+    return uj / 1.0e6 / 3600.0;
+}
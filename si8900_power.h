@@ -0,0 +1,114 @@
+/*
+ * si8900_power.h
+ * real/reactive/apparent power and energy from a voltage and a current channel.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  The si8900 multiplexes its inputs, so a current reading is taken some
+ *  fraction of a reading period after the voltage reading before it. Each
+ *  current reading is paired with the voltage linearly interpolated to its
+ *  sampling instant (skew_q8 = position between voltage readings, 128 = half
+ *  way, which is what alternating V/I commands give).
+ *
+ *  Per reading pair only integer multiply-adds are done. Once per mains
+ *  cycle (rising voltage zero crossing, see si8900_freq.h) the sums are
+ *  turned into P, Q, S and PF, and the energy counters are advanced.
+ *  No waveform is buffered.
+ *
+ *  P is corrected for the amplitude the interpolation takes off the
+ *  fundamental (cos(pi * f / fs) for skew_q8 = 128).
+ *
+ *  Q is taken from the current against the first difference of the
+ *  voltage, which is a 90 degree shift of the fundamental, so it keeps its
+ *  sign: positive for an inductive (lagging) load.
+ *
+ *  Energy counters are kept in microjoules (uWs, uvar s, uVA s), each cycle
+ *  scaled with the command echo and calibration in force for that cycle, so
+ *  a PGA or reference change only affects energy counted after it. The
+ *  rounding left over each cycle is carried, so nothing is lost. 64 bits of
+ *  uJ hold about 5 GWh (2.5 GWh for the signed reactive counter) -- some 50
+ *  years at 10 kW; a full counter sticks at its limit rather than wrapping.
+ *  Use si8900_power_energy_wh to turn them into watt (var, VA) hours.
+ */
+
+#ifndef si8900_power_H_
+#define si8900_power_H_
+
+/*
+ * includes
+ */
+#include "si8900_freq.h"    // includes "si8900.h"
+#include "si8900_convert.h" // includes "si8900_block.h"
+
+
+/*
+ * energy counter selection for si8900_power_energy_wh
+ */
+#define SI8900_ENERGY_IMPORT    0   // real energy, P > 0
+#define SI8900_ENERGY_EXPORT    1   // real energy, P < 0
+#define SI8900_ENERGY_REACTIVE  2   // reactive energy, signed
+#define SI8900_ENERGY_APPARENT  3   // apparent energy
+
+
+/*
+ * POWER ENGINE STATE
+ */
+typedef struct si8900_power{
+    /* configuration */
+    uint8_t v_inch;             // channel number (0-2) wired to voltage
+    uint8_t i_inch;             // channel number (0-2) wired to current
+    int16_t skew_q8;            // current sampling instant between voltage readings
+    uint32_t fs_mhz;            // reading pair rate
+    si8900_conv_cal v_cal;      // volts at the pin -> volts
+    si8900_conv_cal i_cal;      // volts at the pin -> amps
+    si8900_cfg v_cmd;           // last command echo of each channel
+    si8900_cfg i_cmd;
+
+    /* per reading pair state */
+    si8900_freq freq;           // cycle boundaries and DC of the voltage
+    int32_t i_dc_q8;            // DC of the current
+    int32_t v_prev_q4;          // last voltage reading, AC part
+    int32_t i_pend_q4;          // current reading waiting for the next voltage
+    uint8_t have_v;
+    uint8_t have_i;
+
+    /* per cycle sums */
+    int64_t sum_vi;
+    uint64_t sum_vv;
+    uint64_t sum_ii;
+    int64_t sum_idv;
+    uint32_t n;
+
+    /* per cycle results */
+    double v_rms;
+    double i_rms;
+    double p_w;
+    double q_var;
+    double s_va;
+    double pf;
+
+    /* energy, uJ */
+    uint64_t e_import;
+    uint64_t e_export;
+    int64_t e_reactive;
+    uint64_t e_apparent;
+    double e_carry_p;           // rounding left over from the real counters
+    double e_carry_q;           // rounding left over from the reactive counter
+    double e_carry_s;           // rounding left over from the apparent counter
+}si8900_power;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_power_init(si8900_power*, uint8_t, uint8_t, uint32_t, int16_t,
+                       const si8900_conv_cal*, const si8900_conv_cal*);
+uint8_t si8900_power_update(si8900_power*, const si8900_reading*);
+double si8900_power_energy_wh(const si8900_power*, uint8_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_power_H_ */
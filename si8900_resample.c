@@ -0,0 +1,231 @@
+/*
+ * si8900_resample.c
+ * implementation file for the si8900 uniform timebase resampler.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_resample.h" // includes "si8900_block.h"
+
+#include <string.h>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+
+/*
+ *  name: si8900_resamp_eval
+ *
+ *  desc: evaluates n staged outputs from their segment and position
+ */
+static void si8900_resamp_eval(const si8900_resamp* r, float* out, uint32_t n)
+{
+    uint32_t k = 0;
+
+#ifdef __AVX2__
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256i j = _mm256_loadu_si256((const __m256i*)(r->seg + k));
+        __m256i j1 = _mm256_add_epi32(j, _mm256_set1_epi32(1));
+        __m256 u = _mm256_loadu_ps(r->u + k);
+        __m256 p1 = _mm256_i32gather_ps(r->x, j, 4);
+        __m256 p2 = _mm256_i32gather_ps(r->x, j1, 4);
+        __m256 dt = _mm256_sub_ps(_mm256_i32gather_ps(r->lt, j1, 4), _mm256_i32gather_ps(r->lt, j, 4));
+        __m256 m1 = _mm256_mul_ps(_mm256_i32gather_ps(r->slope, j, 4), dt);
+        __m256 m2 = _mm256_mul_ps(_mm256_i32gather_ps(r->slope, j1, 4), dt);
+        __m256 u2 = _mm256_mul_ps(u, u);
+        __m256 u3 = _mm256_mul_ps(u2, u);
+        // hermite basis
+        __m256 h01 = _mm256_sub_ps(_mm256_mul_ps(three, u2), _mm256_mul_ps(two, u3));
+        __m256 h00 = _mm256_sub_ps(one, h01);
+        __m256 h10 = _mm256_add_ps(_mm256_sub_ps(u3, _mm256_mul_ps(two, u2)), u);
+        __m256 h11 = _mm256_sub_ps(u3, u2);
+        __m256 y = _mm256_mul_ps(h00, p1);
+    #ifdef __FMA__
+        y = _mm256_fmadd_ps(h10, m1, y);
+        y = _mm256_fmadd_ps(h01, p2, y);
+        y = _mm256_fmadd_ps(h11, m2, y);
+    #else
+        y = _mm256_add_ps(y, _mm256_mul_ps(h10, m1));
+        y = _mm256_add_ps(y, _mm256_mul_ps(h01, p2));
+        y = _mm256_add_ps(y, _mm256_mul_ps(h11, m2));
+    #endif
+        _mm256_storeu_ps(out + k, y);
+    }
+#endif
+
+    for (; k < n; k++)
+    {
+        int32_t j = r->seg[k];
+        float u = r->u[k], u2 = u * u, u3 = u2 * u;
+        float dt = r->lt[j + 1] - r->lt[j];
+        float h01 = 3.0f * u2 - 2.0f * u3;
+        out[k] = (1.0f - h01) * r->x[j] + (u3 - 2.0f * u2 + u) * r->slope[j] * dt +
+                 h01 * r->x[j + 1] + (u3 - u2) * r->slope[j + 1] * dt;
+    }
+}
+
+
+/*
+ *  name: si8900_resamp_init
+ *
+ *  desc: sets up a resampler
+ *
+ *  args:
+ *      si8900_resamp* r       : resampler to set up (large, allocate statically
+ *                               or on the heap)
+ *      si8900_tstamp t_first  : time of the first output
+ *      si8900_tstamp period   : output spacing, > 0
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      static si8900_resamp rs;
+ *      si8900_resamp_init(&rs, t_start, 100000); // 10 kHz output, ns timestamps
+ */
+void si8900_resamp_init(si8900_resamp* r, si8900_tstamp t_first, si8900_tstamp period)
+{
+    r->period = period ? period : 1;
+    r->next = t_first;
+    r->started = 0;
+    r->held = 0;
+}
+
+
+/*
+ *  name: si8900_resamp_process
+ *
+ *  desc: feeds timestamped readings (time ascending) and writes every
+ *        output they make available
+ *
+ *  args:
+ *      si8900_resamp* r        : resampler
+ *      const si8900_tstamp* t  : input times
+ *      const float* x          : input values, eg: from si8900_convert_f32
+ *      size_t n                : number of inputs
+ *      float* out              : outputs, out[k] is at *t_out + k * period
+ *      size_t out_cap          : room in 'out'
+ *      size_t* consumed        : set to the inputs used up, less than n only
+ *                                when 'out' filled up, may be NULL
+ *      si8900_tstamp* t_out    : set to the time of out[0] (of the next output
+ *                                when none were written), may be NULL
+ *
+ *  return value:
+ *      size_t: outputs written
+ *
+ *  example:
+ *      si8900_tstamp t0;
+ *      m = si8900_resamp_process(&rs, times, volts, n, uniform, cap, &used, &t0);
+ *      // uniform[k] is at t0 + k * period
+ */
+size_t si8900_resamp_process(si8900_resamp* r, const si8900_tstamp* t, const float* x, size_t n,
+                             float* out, size_t out_cap, size_t* consumed, si8900_tstamp* t_out)
+{
+    size_t done = 0, produced = 0;
+    si8900_tstamp first = 0;
+
+    while (done < n)
+    {
+        uint32_t chunk = (n - done > SI8900_RESAMP_CHUNK) ? SI8900_RESAMP_CHUNK : (uint32_t)(n - done);
+        uint32_t m, i, j, k;
+        si8900_tstamp base;
+        double inv_period = 1.0 / (double)r->period;
+
+        // never stage inputs whose outputs could overflow 'out'
+        while (chunk && t[done + chunk - 1] >= r->next &&
+               (t[done + chunk - 1] - r->next) / r->period + 1 > out_cap - produced)
+        {
+            chunk /= 2;
+        }
+        if (!chunk)
+        {
+            break;
+        }
+
+        memcpy(r->t + r->held, t + done, chunk * sizeof(si8900_tstamp));
+        memcpy(r->x + r->held, x + done, chunk * sizeof(float));
+        m = r->held + chunk;
+        done += chunk;
+        if (m < 4)
+        {
+            r->held = m; // not enough points for a segment yet
+            continue;
+        }
+
+        if (!r->started)
+        {
+            // skip outputs before the first segment that can be interpolated
+            if (r->next < r->t[1])
+            {
+                r->next += ((r->t[1] - r->next + r->period - 1) / r->period) * r->period;
+            }
+            r->started = 1;
+        }
+
+        // times in output periods after 'next', tangent slopes per period
+        // (the skip above may have moved 'next' during this call)
+        base = r->next;
+        if (!produced)
+        {
+            first = base;
+        }
+        for (i = 0; i < m; i++)
+        {
+            r->lt[i] = (float)(((double)r->t[i] - (double)base) * inv_period);
+        }
+        for (i = 1; i + 1 < m; i++)
+        {
+            float span = r->lt[i + 1] - r->lt[i - 1];
+            r->slope[i] = (span > 0.0f) ? (r->x[i + 1] - r->x[i - 1]) / span : 0.0f;
+        }
+
+        // output k of this pass sits at time k (in periods); segment j needs points j-1 .. j+2
+        j = 1;
+        k = 0;
+        for (;;)
+        {
+            uint32_t batch = 0;
+            while (batch < SI8900_RESAMP_CHUNK)
+            {
+                float tk = (float)(k + batch);
+                while (j + 2 < m && tk >= r->lt[j + 1])
+                {
+                    j++;
+                }
+                if (j + 2 >= m || tk < r->lt[j])
+                {
+                    break;
+                }
+                r->seg[batch] = (int32_t)j;
+                r->u[batch] = (tk - r->lt[j]) / (r->lt[j + 1] - r->lt[j]);
+                batch++;
+            }
+            if (!batch)
+            {
+                break;
+            }
+            si8900_resamp_eval(r, out + produced, batch);
+            produced += batch;
+            k += batch;
+        }
+        r->next = base + (si8900_tstamp)k * r->period;
+
+        // carry the last three points
+        memmove(r->t, r->t + m - 3, 3 * sizeof(si8900_tstamp));
+        memmove(r->x, r->x + m - 3, 3 * sizeof(float));
+        r->held = 3;
+    }
+
+    if (consumed)
+    {
+        *consumed = done;
+    }
+    if (t_out)
+    {
+        *t_out = produced ? first : r->next;
+    }
+    return produced;
+}
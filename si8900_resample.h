@@ -0,0 +1,72 @@
+/*
+ * si8900_resample.h
+ * resampler from UART paced si8900 readings to a uniform timebase (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option.
+ *
+ *  Readings arrive with their own timestamps (command overhead and channel
+ *  switching jitter the spacing). Outputs are produced at exactly
+ *  t_first + k * period by cubic Hermite interpolation with Catmull-Rom
+ *  tangents worked out for the actual, uneven input spacing. A windowed
+ *  sinc would assume an even input grid, which is what this stage exists
+ *  to provide.
+ *
+ *  Streaming with bounded latency: three input points are carried between
+ *  calls, so an output is produced as soon as the two inputs after it have
+ *  arrived. Work is staged in SI8900_RESAMP_CHUNK sized passes: segment
+ *  lookup is scalar, the polynomial evaluation uses AVX2 gathers and FMA
+ *  when targeted.
+ *
+ *  Outputs before the second input point can not be interpolated and are
+ *  skipped (t_first moves forward by whole periods, possibly inside the call
+ *  that writes the first outputs -- take their time from the call's t_out).
+ */
+
+#ifndef si8900_resample_H_
+#define si8900_resample_H_
+
+#ifndef PC_
+    #error "si8900_resample is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h", si8900_tstamp
+
+
+#define SI8900_RESAMP_CHUNK 1024
+
+
+/*
+ * RESAMPLER STATE
+ */
+typedef struct si8900_resamp{
+    si8900_tstamp period;       // output spacing
+    si8900_tstamp next;         // time of the next output
+    uint8_t started;            // first outputs skipped up to the data
+    uint32_t held;              // input points carried in line[0 .. held-1]
+    si8900_tstamp t[SI8900_RESAMP_CHUNK + 3];   // staged input times
+    float x[SI8900_RESAMP_CHUNK + 3];           // staged input values
+    float lt[SI8900_RESAMP_CHUNK + 3];          // input times in periods after 'next'
+    float slope[SI8900_RESAMP_CHUNK + 3];       // tangent slope per period
+    int32_t seg[SI8900_RESAMP_CHUNK];           // per output segment start
+    float u[SI8900_RESAMP_CHUNK];               // per output position in segment
+}si8900_resamp;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_resamp_init(si8900_resamp*, si8900_tstamp, si8900_tstamp);
+size_t si8900_resamp_process(si8900_resamp*, const si8900_tstamp*, const float*, size_t,
+                             float*, size_t, size_t*, si8900_tstamp*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_resample_H_ */
@@ -0,0 +1,364 @@
+/*
+ * si8900_robust.c
+ * implementation file for glitch rejecting si8900 reducers.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_robust.h" // includes "si8900.h"
+
+
+/*
+ * branch free compare exchange: v[i] <= v[j] afterwards
+ */
+#define SI8900_CSWAP(v, i, j) do { \
+        int32_t d_ = (int32_t)(v)[i] - (int32_t)(v)[j];     \
+        int32_t m_ = d_ & -(int32_t)((uint32_t)d_ >> 31);   \
+        (v)[i] = (uint16_t)((v)[j] + m_);                   \
+        (v)[j] = (uint16_t)((v)[j] + d_ - m_);              \
+    } while (0)
+
+
+/*
+ * sorting networks, optimal comparator counts
+ */
+static void si8900_sort3(uint16_t* v)
+{
+    SI8900_CSWAP(v, 0, 1); SI8900_CSWAP(v, 1, 2); SI8900_CSWAP(v, 0, 1);
+}
+
+static void si8900_sort5(uint16_t* v)
+{
+    SI8900_CSWAP(v, 0, 1); SI8900_CSWAP(v, 3, 4); SI8900_CSWAP(v, 2, 4);
+    SI8900_CSWAP(v, 2, 3); SI8900_CSWAP(v, 0, 3); SI8900_CSWAP(v, 0, 2);
+    SI8900_CSWAP(v, 1, 4); SI8900_CSWAP(v, 1, 3); SI8900_CSWAP(v, 1, 2);
+}
+
+static void si8900_sort7(uint16_t* v)
+{
+    SI8900_CSWAP(v, 0, 6); SI8900_CSWAP(v, 2, 3); SI8900_CSWAP(v, 4, 5);
+    SI8900_CSWAP(v, 0, 2); SI8900_CSWAP(v, 1, 4); SI8900_CSWAP(v, 3, 6);
+    SI8900_CSWAP(v, 0, 1); SI8900_CSWAP(v, 2, 5); SI8900_CSWAP(v, 3, 4);
+    SI8900_CSWAP(v, 1, 2); SI8900_CSWAP(v, 4, 6); SI8900_CSWAP(v, 2, 3);
+    SI8900_CSWAP(v, 4, 5); SI8900_CSWAP(v, 1, 2); SI8900_CSWAP(v, 3, 4);
+    SI8900_CSWAP(v, 5, 6);
+}
+
+static void si8900_sort9(uint16_t* v)
+{
+    SI8900_CSWAP(v, 0, 3); SI8900_CSWAP(v, 1, 7); SI8900_CSWAP(v, 2, 5);
+    SI8900_CSWAP(v, 4, 8); SI8900_CSWAP(v, 0, 7); SI8900_CSWAP(v, 2, 4);
+    SI8900_CSWAP(v, 3, 8); SI8900_CSWAP(v, 5, 6); SI8900_CSWAP(v, 0, 2);
+    SI8900_CSWAP(v, 1, 3); SI8900_CSWAP(v, 4, 5); SI8900_CSWAP(v, 7, 8);
+    SI8900_CSWAP(v, 1, 4); SI8900_CSWAP(v, 3, 6); SI8900_CSWAP(v, 5, 7);
+    SI8900_CSWAP(v, 0, 1); SI8900_CSWAP(v, 2, 4); SI8900_CSWAP(v, 3, 5);
+    SI8900_CSWAP(v, 6, 8); SI8900_CSWAP(v, 2, 3); SI8900_CSWAP(v, 4, 5);
+    SI8900_CSWAP(v, 6, 7); SI8900_CSWAP(v, 1, 2); SI8900_CSWAP(v, 3, 4);
+    SI8900_CSWAP(v, 5, 6);
+}
+
+
+#ifdef PC_
+/*
+ *  name: si8900_select
+ *
+ *  desc: quickselect, moves the k-th smallest of v[lo .. hi] to v[k] with
+ *        smaller values before it and larger after it
+ */
+static void si8900_select(uint16_t* v, size_t lo, size_t hi, size_t k)
+{
+    while (hi > lo)
+    {
+        size_t mid = lo + (hi - lo) / 2, i = lo, j = hi;
+        uint16_t pivot, t;
+
+        // median of three pivot
+        if (v[mid] < v[lo]) { t = v[mid]; v[mid] = v[lo]; v[lo] = t; }
+        if (v[hi] < v[lo])  { t = v[hi]; v[hi] = v[lo]; v[lo] = t; }
+        if (v[hi] < v[mid]) { t = v[hi]; v[hi] = v[mid]; v[mid] = t; }
+        pivot = v[mid];
+
+        while (i <= j)
+        {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i <= j)
+            {
+                t = v[i]; v[i] = v[j]; v[j] = t;
+                i++;
+                if (j == 0) break;
+                j--;
+            }
+        }
+        if (k <= j)
+        {
+            hi = j;
+        }
+        else if (k >= i)
+        {
+            lo = i;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+#endif /* PC_ */
+
+
+/*
+ *  name: si8900_order
+ *
+ *  desc: puts v[k] in sorted position, with v[0 .. k-1] <= v[k] <= v[k+1 ..]
+ *        (fully sorts on the network and insertion sort paths)
+ */
+static void si8900_order(uint16_t* v, size_t n, size_t k)
+{
+#ifdef PC_
+    if (n > 16)
+    {
+        si8900_select(v, 0, n - 1, k);
+        return;
+    }
+#else
+    (void)k;
+#endif
+    si8900_sort_small(v, n);
+}
+
+
+/*
+ *  name: si8900_sort_small
+ *
+ *  desc: sorts a short array ascending, with a sorting network for
+ *        3, 5, 7 and 9 entries and insertion sort otherwise
+ *
+ *  args:
+ *      uint16_t* v : readings to sort
+ *      size_t n    : number of readings
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      uint16_t r[5] = {512, 514, 1023, 511, 513};
+ *      si8900_sort_small(r, 5); // {511, 512, 513, 514, 1023}
+ */
+void si8900_sort_small(uint16_t* v, size_t n)
+{
+    size_t i, j;
+    switch (n)
+    {
+    case 3: si8900_sort3(v); return;
+    case 5: si8900_sort5(v); return;
+    case 7: si8900_sort7(v); return;
+    case 9: si8900_sort9(v); return;
+    default: break;
+    }
+    for (i = 1; i < n; i++)
+    {
+        uint16_t x = v[i];
+        for (j = i; j > 0 && v[j - 1] > x; j--)
+        {
+            v[j] = v[j - 1];
+        }
+        v[j] = x;
+    }
+}
+
+
+/*
+ *  name: si8900_median
+ *
+ *  desc: median of an array of readings (upper median for even counts)
+ *
+ *  args:
+ *      uint16_t* v   : readings, reordered
+ *      size_t n      : number of readings
+ *      uint16_t* out : set to the median, untouched on failure
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when n is 0
+ *
+ *  example:
+ *      uint16_t r[5] = {512, 514, 1023, 511, 513};
+ *      uint16_t m;
+ *      si8900_median(r, 5, &m); // 513, the 1023 glitch has no effect
+ */
+uint8_t si8900_median(uint16_t* v, size_t n, uint16_t* out)
+{
+    if (!n)
+    {
+        return FAILED;
+    }
+    si8900_order(v, n, n / 2);
+    *out = v[n / 2];
+    return 0;
+}
+
+
+/*
+ *  name: si8900_trimmed_mean
+ *
+ *  desc: mean of the readings left after dropping the 'trim' lowest and
+ *        'trim' highest
+ *
+ *  args:
+ *      uint16_t* v   : readings, reordered
+ *      size_t n      : number of readings
+ *      size_t trim   : readings dropped off each end
+ *      uint16_t* out : set to the rounded mean, untouched on failure
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when nothing is left
+ *
+ *  example:
+ *      uint16_t m;
+ *      if (si8900_trimmed_mean(r, 9, 2, &m) == 0)
+ *      {
+ *          // m is the mean of the middle 5
+ *      }
+ */
+uint8_t si8900_trimmed_mean(uint16_t* v, size_t n, size_t trim, uint16_t* out)
+{
+    uint32_t sum = 0;
+    size_t i, kept;
+
+    if (2 * trim >= n)
+    {
+        return FAILED;
+    }
+    kept = n - 2 * trim;
+#ifdef PC_
+    if (n > 16 && trim)
+    {
+        // split off the low trim, then the high trim of what is left
+        si8900_select(v, 0, n - 1, trim);
+        si8900_select(v, trim, n - 1, n - 1 - trim);
+    }
+    else
+#endif
+    {
+        si8900_sort_small(v, n);
+    }
+    for (i = trim; i < n - trim; i++)
+    {
+        sum += v[i];
+    }
+    *out = (uint16_t)((sum + kept / 2) / kept);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_mad_mean
+ *
+ *  desc: mean of the readings within k times the median absolute
+ *        deviation (MAD) of the median. When the MAD is 0 only readings
+ *        equal to the median are kept.
+ *
+ *  args:
+ *      uint16_t* v       : readings, reordered
+ *      size_t n          : number of readings
+ *      uint8_t k_q4      : k with 4 fractional bits, eg: 48 for 3 MAD
+ *      uint16_t* scratch : n entries of scratch space
+ *      uint16_t* out     : set to the rounded mean, untouched on failure
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when n is 0
+ *
+ *  example:
+ *      uint16_t scratch[7], m;
+ *      if (si8900_mad_mean(r, 7, 48, scratch, &m))
+ *      {
+ *          // throw error
+ *      }
+ */
+uint8_t si8900_mad_mean(uint16_t* v, size_t n, uint8_t k_q4, uint16_t* scratch, uint16_t* out)
+{
+    uint16_t med, mad;
+    uint32_t limit_q4, sum = 0, kept = 0;
+    size_t i;
+
+    if (!n)
+    {
+        return FAILED;
+    }
+    si8900_order(v, n, n / 2);
+    med = v[n / 2];
+    for (i = 0; i < n; i++)
+    {
+        scratch[i] = (v[i] > med) ? (uint16_t)(v[i] - med) : (uint16_t)(med - v[i]);
+    }
+    si8900_order(scratch, n, n / 2);
+    mad = scratch[n / 2];
+    limit_q4 = (uint32_t)mad * k_q4;
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t dev = (v[i] > med) ? (uint32_t)(v[i] - med) : (uint32_t)(med - v[i]);
+        if ((dev << 4) <= limit_q4)
+        {
+            sum += v[i];
+            kept++;
+        }
+    }
+    *out = (uint16_t)((sum + kept / 2) / kept); // kept >= 1, the median itself
+    return 0;
+}
+
+
+/*
+ *  name: si8900_get_reading_oversampled_median
+ *
+ *  desc: performs multiple acquisitions and gives the median of the
+ *        valid readings, the glitch rejecting version of
+ *        si8900_get_reading_oversampled. At most
+ *        SI8900_ROBUST_MAX_SAMPLES acquisitions are kept.
+ *
+ *  args:
+ *      uint8_t* buffer     : buffer to read the first 3 bytes from
+ *      uint8_t ref_byte    : references byte to validate buffer contains a full response form si8900
+ *      uint8_t sample_count: how many samples to take, odd counts avoid the upper median bias
+ *
+ *  return value:
+ *      si8900_reading struct containing reading and inch information
+ *      returns a structure with FAILED as both inch and reading
+ *      when no acquisition was valid
+ *
+ *  example:
+ *      uint8_t buffer [BUFSIZE] = {0};
+ *      si8900_reading reading = si8900_get_reading_oversampled_median(buffer, GP_SINGLE_READ_0, 5);
+ *      if(reading.inch != FAILED)
+ *      {
+ *          // continue with code execution
+ *      }
+ */
+si8900_reading si8900_get_reading_oversampled_median(uint8_t* buffer, uint8_t ref_byte, uint8_t sample_count)
+{
+    uint16_t vals[SI8900_ROBUST_MAX_SAMPLES];
+    uint8_t i, entries = 0;
+    si8900_reading temp, last;
+
+    last.cmd_byte = ref_byte;
+    last.inch = FAILED;
+    last.reading = FAILED;
+    if (sample_count > SI8900_ROBUST_MAX_SAMPLES)
+    {
+        sample_count = SI8900_ROBUST_MAX_SAMPLES;
+    }
+    for (i = 0; i < sample_count; i++)
+    {
+        temp = si8900_get_reading(buffer, ref_byte);
+        if (temp.inch != FAILED) // 255 is a valid reading, inch is not
+        {
+            vals[entries++] = temp.reading;
+            last = temp;
+        }
+    }
+    if (si8900_median(vals, entries, &last.reading))
+    {
+        last.inch = FAILED;
+        last.reading = FAILED;
+    }
+    return last;
+}
@@ -0,0 +1,58 @@
+/*
+ * si8900_robust.h
+ * glitch rejecting reducers for oversampled si8900 readings.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Replacements for the plain average of si8900_get_reading_oversampled
+ *  that are not dragged off by the odd corrupted but valid looking frame:
+ *      median       : middle reading
+ *      trimmed mean : mean after dropping 'trim' readings off each end
+ *      MAD mean     : mean of the readings within k * MAD of the median
+ *
+ *  For 3, 5, 7 and 9 readings (the usual MSP430 oversampling counts) the
+ *  readings are sorted with fixed, branch free sorting networks. Other
+ *  counts use insertion sort, or quickselect for more than 16 readings on
+ *  PC_ builds.
+ *
+ *  All reducers reorder the array they are given. They return 0 or FAILED
+ *  and hand the value back through 'out': FAILED (0xFF) is also a valid
+ *  10 bit reading so it can not double as the error value.
+ *
+ *  si8900_get_reading_oversampled_median is the drop in median version of
+ *  si8900_get_reading_oversampled. It keeps its readings on the stack, at
+ *  most SI8900_ROBUST_MAX_SAMPLES of them.
+ */
+
+#ifndef si8900_robust_H_
+#define si8900_robust_H_
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+/*
+ * most acquisitions si8900_get_reading_oversampled_median keeps
+ */
+#ifndef SI8900_ROBUST_MAX_SAMPLES
+    #define SI8900_ROBUST_MAX_SAMPLES   15
+#endif
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_sort_small(uint16_t*, size_t);
+uint8_t si8900_median(uint16_t*, size_t, uint16_t*);
+uint8_t si8900_trimmed_mean(uint16_t*, size_t, size_t, uint16_t*);
+uint8_t si8900_mad_mean(uint16_t*, size_t, uint8_t, uint16_t*, uint16_t*);
+si8900_reading si8900_get_reading_oversampled_median(uint8_t*, uint8_t, uint8_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_robust_H_ */
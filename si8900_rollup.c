@@ -0,0 +1,377 @@
+/*
+ * si8900_rollup.c
+ * implementation file for the si8900 multi resolution rollup store.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_rollup.h" // includes "si8900_block.h"
+
+
+/*
+ *  name: si8900_bucket_clear
+ *
+ *  desc: empties a bucket and gives it its start number
+ */
+static void si8900_bucket_clear(si8900_bucket* b, uint32_t start)
+{
+    b->start = start;
+    b->count = 0;
+    b->min = 0xFFFFu;
+    b->max = 0;
+    b->sum = 0;
+    b->sum_sq = 0;
+}
+
+
+/*
+ *  name: si8900_bucket_merge
+ *
+ *  desc: folds bucket src into bucket dst
+ */
+static void si8900_bucket_merge(si8900_bucket* dst, const si8900_bucket* src)
+{
+    if (!src->count)
+    {
+        return;
+    }
+    if (src->min < dst->min)
+    {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->sum_sq += src->sum_sq;
+}
+
+
+/*
+ *  name: si8900_rollup_close
+ *
+ *  desc: closes the open bucket of tier t into its ring and cascades
+ *        it into the tier above
+ */
+static void si8900_rollup_close(si8900_rollup* r, uint8_t t)
+{
+    si8900_tier* tier = &r->tier[t];
+
+    tier->ring[tier->closed % tier->len] = tier->open;
+    tier->closed++;
+    tier->parts = 0;
+
+    if (t + 1 < SI8900_NUM_TIERS)
+    {
+        si8900_tier* up = &r->tier[t + 1];
+        si8900_bucket_merge(&up->open, &tier->open);
+        if (++up->parts >= up->per)
+        {
+            si8900_rollup_close(r, (uint8_t)(t + 1));
+        }
+    }
+    si8900_bucket_clear(&tier->open, tier->closed);
+}
+
+
+/*
+ *  name: si8900_rollup_init
+ *
+ *  desc: sets up an empty rollup store for one channel
+ *
+ *  args:
+ *      si8900_rollup* r : store to set up
+ *      uint8_t inch     : channel number (0-2) it holds, used for export
+ *      uint32_t fs      : readings of this channel per second
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      static si8900_rollup roll[SI8900_NUM_CH];
+ *      si8900_rollup_init(&roll[0], 0, 1000);
+ */
+void si8900_rollup_init(si8900_rollup* r, uint8_t inch, uint32_t fs)
+{
+    uint8_t t;
+
+    r->inch = inch;
+    r->tier[SI8900_TIER_SEC].ring = r->sec_ring;
+    r->tier[SI8900_TIER_SEC].len = SI8900_ROLLUP_SEC;
+    r->tier[SI8900_TIER_SEC].per = fs ? fs : 1;
+    r->tier[SI8900_TIER_MIN].ring = r->min_ring;
+    r->tier[SI8900_TIER_MIN].len = SI8900_ROLLUP_MIN;
+    r->tier[SI8900_TIER_MIN].per = 60;
+    r->tier[SI8900_TIER_HOUR].ring = r->hour_ring;
+    r->tier[SI8900_TIER_HOUR].len = SI8900_ROLLUP_HOUR;
+    r->tier[SI8900_TIER_HOUR].per = 60;
+    for (t = 0; t < SI8900_NUM_TIERS; t++)
+    {
+        r->tier[t].closed = 0;
+        r->tier[t].parts = 0;
+        si8900_bucket_clear(&r->tier[t].open, 0);
+    }
+}
+
+
+/*
+ *  name: si8900_rollup_push
+ *
+ *  desc: folds one reading into the store
+ *
+ *  args:
+ *      si8900_rollup* r : store
+ *      uint16_t reading : next reading of the channel
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_rollup_push(&roll[reading.inch], reading.reading);
+ */
+void si8900_rollup_push(si8900_rollup* r, uint16_t reading)
+{
+    si8900_tier* sec = &r->tier[SI8900_TIER_SEC];
+    si8900_bucket* b = &sec->open;
+
+    if (reading < b->min)
+    {
+        b->min = reading;
+    }
+    if (reading > b->max)
+    {
+        b->max = reading;
+    }
+    b->count++;
+    b->sum += reading;
+    b->sum_sq += (uint32_t)reading * reading;
+
+    if (++sec->parts >= sec->per)
+    {
+        si8900_rollup_close(r, SI8900_TIER_SEC);
+    }
+}
+
+
+/*
+ *  name: si8900_rollup_push_block
+ *
+ *  desc: pushes every channel row of a sample block into the matching store
+ *
+ *  args:
+ *      si8900_rollup r[SI8900_NUM_CH] : one store per channel
+ *      const si8900_block* blk        : block to push
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_rollup_push_block(roll, &blk);
+ */
+void si8900_rollup_push_block(si8900_rollup r[SI8900_NUM_CH], const si8900_block* blk)
+{
+    uint8_t ch;
+    uint16_t i;
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        for (i = 0; i < blk->count[ch]; i++)
+        {
+            si8900_rollup_push(&r[ch], blk->reading[ch][i]);
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_rollup_count
+ *
+ *  desc: number of closed buckets still held by a tier
+ *
+ *  args:
+ *      const si8900_rollup* r : store
+ *      uint8_t tier           : SI8900_TIER_x
+ *
+ *  return value:
+ *      uint32_t: buckets available to si8900_rollup_get
+ *
+ *  example:
+ *      n = si8900_rollup_count(&roll[0], SI8900_TIER_MIN);
+ */
+uint32_t si8900_rollup_count(const si8900_rollup* r, uint8_t tier)
+{
+    const si8900_tier* t = &r->tier[tier];
+    return (t->closed < t->len) ? t->closed : t->len;
+}
+
+
+/*
+ *  name: si8900_rollup_get
+ *
+ *  desc: closed bucket of a tier, oldest first
+ *
+ *  args:
+ *      const si8900_rollup* r : store
+ *      uint8_t tier           : SI8900_TIER_x
+ *      uint32_t i             : 0 for the oldest held bucket,
+ *                               si8900_rollup_count() - 1 for the newest
+ *
+ *  return value:
+ *      const si8900_bucket*: the bucket, NULL when i is out of range
+ *
+ *  example:
+ *      const si8900_bucket* last = si8900_rollup_get(&roll[0], SI8900_TIER_SEC,
+ *                                      si8900_rollup_count(&roll[0], SI8900_TIER_SEC) - 1);
+ */
+const si8900_bucket* si8900_rollup_get(const si8900_rollup* r, uint8_t tier, uint32_t i)
+{
+    const si8900_tier* t = &r->tier[tier];
+    uint32_t held = si8900_rollup_count(r, tier);
+    if (i >= held)
+    {
+        return NULL;
+    }
+    return &t->ring[(t->closed - held + i) % t->len];
+}
+
+
+/*
+ *  name: si8900_bucket_mean_q8
+ *
+ *  desc: mean reading of a bucket with 8 fractional bits
+ *
+ *  args:
+ *      const si8900_bucket* b : bucket
+ *
+ *  return value:
+ *      uint32_t: mean, 0 for an empty bucket
+ *
+ *  example:
+ *      uint16_t mean = si8900_bucket_mean_q8(b) >> 8;
+ */
+uint32_t si8900_bucket_mean_q8(const si8900_bucket* b)
+{
+    return b->count ? (uint32_t)((b->sum << 8) / b->count) : 0;
+}
+
+
+/*
+ *  name: si8900_bucket_rms_q8
+ *
+ *  desc: RMS of a bucket with 8 fractional bits
+ *
+ *  args:
+ *      const si8900_bucket* b : bucket
+ *      uint8_t ac             : 1 to remove the bucket mean first (AC RMS),
+ *                               0 for the RMS of the raw readings
+ *
+ *  return value:
+ *      uint32_t: RMS, 0 for an empty bucket
+ *
+ *  example:
+ *      uint32_t mains_rms_q8 = si8900_bucket_rms_q8(b, 1);
+ */
+uint32_t si8900_bucket_rms_q8(const si8900_bucket* b, uint8_t ac)
+{
+    uint64_t ms_q16, root = 0, bit = (uint64_t)1 << 62;
+
+    if (!b->count)
+    {
+        return 0;
+    }
+    ms_q16 = b->sum_sq;
+    if (ac)
+    {
+        ms_q16 -= (b->sum * b->sum) / b->count; // count * variance
+    }
+    ms_q16 = (ms_q16 << 16) / b->count;
+
+    while (bit > ms_q16)
+    {
+        bit >>= 2;
+    }
+    while (bit)
+    {
+        if (ms_q16 >= root + bit)
+        {
+            ms_q16 -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+
+/*
+ *  name: si8900_rollup_put
+ *
+ *  desc: writes an n byte little endian value
+ */
+static uint8_t* si8900_rollup_put(uint8_t* out, uint64_t v, uint8_t n)
+{
+    uint8_t i;
+    for (i = 0; i < n; i++)
+    {
+        *out++ = (uint8_t)(v & 0xFF);
+        v >>= 8;
+    }
+    return out;
+}
+
+
+/*
+ *  name: si8900_rollup_export
+ *
+ *  desc: writes the closed buckets of a tier, oldest first, as a header
+ *        and flat little endian records
+ *
+ *  args:
+ *      const si8900_rollup* r : store
+ *      uint8_t tier           : SI8900_TIER_x
+ *      uint8_t* out           : buffer to write to
+ *      size_t cap             : size of 'out' in bytes
+ *
+ *  return value:
+ *      size_t: bytes written, 0 if 'out' is too small
+ *
+ *  example:
+ *      uint8_t buf[SI8900_ROLLUP_HDR_LEN + SI8900_ROLLUP_MIN * SI8900_ROLLUP_REC_LEN];
+ *      size_t n = si8900_rollup_export(&roll[0], SI8900_TIER_MIN, buf, sizeof(buf));
+ */
+size_t si8900_rollup_export(const si8900_rollup* r, uint8_t tier, uint8_t* out, size_t cap)
+{
+    uint32_t held = si8900_rollup_count(r, tier), i;
+    uint8_t* p = out;
+
+    if (held > 0xFFFFu)
+    {
+        held = 0xFFFFu; // newest are dropped, count field is 16 bit
+    }
+    if (cap < SI8900_ROLLUP_HDR_LEN + (size_t)held * SI8900_ROLLUP_REC_LEN)
+    {
+        return 0;
+    }
+
+    *p++ = 'S';
+    *p++ = '9';
+    *p++ = 'R';
+    *p++ = SI8900_ROLLUP_VERSION;
+    *p++ = r->inch;
+    *p++ = tier;
+    p = si8900_rollup_put(p, held, 2);
+    for (i = 0; i < held; i++)
+    {
+        const si8900_bucket* b = si8900_rollup_get(r, tier, i);
+        p = si8900_rollup_put(p, b->start, 4);
+        p = si8900_rollup_put(p, b->count, 4);
+        p = si8900_rollup_put(p, b->min, 2);
+        p = si8900_rollup_put(p, b->max, 2);
+        p = si8900_rollup_put(p, b->sum, 8);
+        p = si8900_rollup_put(p, b->sum_sq, 8);
+    }
+    return (size_t)(p - out);
+}
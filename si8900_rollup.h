@@ -0,0 +1,127 @@
+/*
+ * si8900_rollup.h
+ * multi resolution (1 s / 1 min / 1 h) rollup store for si8900 readings.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Readings of one channel are folded into a seconds bucket (min, max,
+ *  count, sum, sum of squares). Every fs readings the seconds bucket is
+ *  closed into the seconds ring and merged into the open minutes bucket,
+ *  every 60 seconds the minutes bucket is closed and merged into the hours
+ *  bucket, and so on. Each tier keeps a fixed ring of closed buckets, so
+ *  memory does not grow however long it runs.
+ *
+ *  si8900_rollup_export writes a tier as a flat little endian record
+ *  array (see SI8900_ROLLUP_HDR_LEN / SI8900_ROLLUP_REC_LEN) for storage
+ *  next to raw captures.
+ *
+ *  Optional values: -- define in build config
+ *      SI8900_ROLLUP_SEC  : closed seconds buckets kept (default 3600 PC_, 8 otherwise)
+ *      SI8900_ROLLUP_MIN  : closed minutes buckets kept (default 1440 PC_, 8 otherwise)
+ *      SI8900_ROLLUP_HOUR : closed hours buckets kept   (default 720 PC_, 8 otherwise)
+ */
+
+#ifndef si8900_rollup_H_
+#define si8900_rollup_H_
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h"
+
+
+#ifdef PC_
+    #define SI8900_ROLLUP_SEC_DEFAULT   3600
+    #define SI8900_ROLLUP_MIN_DEFAULT   1440
+    #define SI8900_ROLLUP_HOUR_DEFAULT  720
+#else
+    #define SI8900_ROLLUP_SEC_DEFAULT   8
+    #define SI8900_ROLLUP_MIN_DEFAULT   8
+    #define SI8900_ROLLUP_HOUR_DEFAULT  8
+#endif
+#ifndef SI8900_ROLLUP_SEC
+    #define SI8900_ROLLUP_SEC   SI8900_ROLLUP_SEC_DEFAULT
+#endif
+#ifndef SI8900_ROLLUP_MIN
+    #define SI8900_ROLLUP_MIN   SI8900_ROLLUP_MIN_DEFAULT
+#endif
+#ifndef SI8900_ROLLUP_HOUR
+    #define SI8900_ROLLUP_HOUR  SI8900_ROLLUP_HOUR_DEFAULT
+#endif
+
+
+/*
+ * tiers
+ */
+#define SI8900_TIER_SEC     0
+#define SI8900_TIER_MIN     1
+#define SI8900_TIER_HOUR    2
+#define SI8900_NUM_TIERS    3
+
+
+/*
+ * export layout, all little endian
+ * header: 'S' '9' 'R' version(1) inch(1) tier(1) count(2)
+ * record: start(4) count(4) min(2) max(2) sum(8) sum_sq(8)
+ */
+#define SI8900_ROLLUP_VERSION   1
+#define SI8900_ROLLUP_HDR_LEN   8
+#define SI8900_ROLLUP_REC_LEN   28
+
+
+/*
+ * one aggregate bucket
+ */
+typedef struct si8900_bucket{
+    uint32_t start;     // second / minute / hour number since the rollup started
+    uint32_t count;     // readings folded in
+    uint16_t min;
+    uint16_t max;
+    uint64_t sum;
+    uint64_t sum_sq;
+}si8900_bucket;
+
+
+/*
+ * one tier: an open bucket and a ring of closed ones
+ */
+typedef struct si8900_tier{
+    si8900_bucket open;
+    si8900_bucket* ring;
+    uint32_t len;       // ring length
+    uint32_t closed;    // buckets closed so far
+    uint32_t parts;     // lower tier buckets (or readings) in the open bucket
+    uint32_t per;       // lower tier buckets (or readings) per bucket
+}si8900_tier;
+
+
+/*
+ * per channel rollup store
+ */
+typedef struct si8900_rollup{
+    uint8_t inch;
+    si8900_tier tier[SI8900_NUM_TIERS];
+    si8900_bucket sec_ring[SI8900_ROLLUP_SEC];
+    si8900_bucket min_ring[SI8900_ROLLUP_MIN];
+    si8900_bucket hour_ring[SI8900_ROLLUP_HOUR];
+}si8900_rollup;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+void si8900_rollup_init(si8900_rollup*, uint8_t, uint32_t);
+void si8900_rollup_push(si8900_rollup*, uint16_t);
+void si8900_rollup_push_block(si8900_rollup[SI8900_NUM_CH], const si8900_block*);
+uint32_t si8900_rollup_count(const si8900_rollup*, uint8_t);
+const si8900_bucket* si8900_rollup_get(const si8900_rollup*, uint8_t, uint32_t);
+uint32_t si8900_bucket_mean_q8(const si8900_bucket*);
+uint32_t si8900_bucket_rms_q8(const si8900_bucket*, uint8_t);
+size_t si8900_rollup_export(const si8900_rollup*, uint8_t, uint8_t*, size_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_rollup_H_ */
@@ -0,0 +1,218 @@
+/*
+ * si8900_scope.c
+ * implementation file for si8900 oscilloscope style triggered capture.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_scope.h" // includes "si8900.h"
+
+
+/*
+ *  name: si8900_scope_init
+ *
+ *  desc: sets up and arms a scope
+ *
+ *  args:
+ *      si8900_scope* s       : scope to set up
+ *      uint8_t inch          : channel number (0-2) to capture
+ *      uint8_t trig          : SI8900_TRIG_x
+ *      uint16_t level        : trigger level, reading counts
+ *      uint16_t pre          : readings kept before the trigger
+ *      uint16_t post         : readings kept from the trigger on (>= 1)
+ *      uint8_t mode          : SI8900_ARM_x
+ *      uint32_t auto_timeout : readings to wait before forcing a trigger
+ *                              in SI8900_ARM_AUTO
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED if pre + post does not fit
+ *      SI8900_SCOPE_DEPTH or the channel is out of range
+ *
+ *  example:
+ *      static si8900_scope scope;
+ *      si8900_scope_init(&scope, 1, SI8900_TRIG_RISING, 512, 64, 192, SI8900_ARM_NORMAL, 0);
+ */
+uint8_t si8900_scope_init(si8900_scope* s, uint8_t inch, uint8_t trig, uint16_t level,
+                          uint16_t pre, uint16_t post, uint8_t mode, uint32_t auto_timeout)
+{
+    if (inch >= SI8900_NUM_CH || post == 0 || (uint32_t)pre + post > SI8900_SCOPE_DEPTH)
+    {
+        s->state = SI8900_SCOPE_IDLE;
+        return FAILED;
+    }
+    s->inch = inch;
+    s->trig = trig;
+    s->level = level;
+    s->pre = pre;
+    s->post = post;
+    s->mode = mode;
+    s->auto_timeout = auto_timeout;
+    s->wpos = 0;
+    si8900_scope_arm(s);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_scope_arm
+ *
+ *  desc: arms the scope for the next capture, dropping any capture not read yet
+ *
+ *  args:
+ *      si8900_scope* s : scope
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_scope_arm(&scope); // take another single shot
+ */
+void si8900_scope_arm(si8900_scope* s)
+{
+    s->filled = 0;
+    s->waited = 0;
+    s->forced = 0;
+    s->prev = s->level; // no edge until a reading has been seen
+    s->state = SI8900_SCOPE_ARMED;
+}
+
+
+/*
+ *  name: si8900_scope_decode
+ *
+ *  desc: decodes raw bytes, feeding the readings of the scope channel
+ *        through the trigger. Stops right after the reading that
+ *        completes a capture so no data is lost while it is read out.
+ *
+ *  args:
+ *      si8900_scope* s   : scope
+ *      const uint8_t* in : raw bytes received from the si8900
+ *      size_t len        : number of bytes in 'in'
+ *      size_t* consumed  : set to the number of bytes of 'in' used up,
+ *                          may be NULL
+ *
+ *  return value:
+ *      uint8_t: 1 when a capture is ready for si8900_scope_read, else 0
+ *
+ *  example:
+ *      size_t used;
+ *      if (si8900_scope_decode(&scope, rx_buf, rx_len, &used))
+ *      {
+ *          n = si8900_scope_read(&scope, trace, NULL);
+ *      }
+ *      // keep rx_buf[used .. rx_len-1] for the next call
+ */
+uint8_t si8900_scope_decode(si8900_scope* s, const uint8_t* in, size_t len, size_t* consumed)
+{
+    size_t pos = 0;
+
+    while (s->state != SI8900_SCOPE_READY)
+    {
+        uint16_t x;
+        uint8_t hit;
+
+        pos = si8900_sync_frame(in, len, pos);
+        if (pos + SI8900_FRAME_LEN > len)
+        {
+            break; // nothing but a partial frame left
+        }
+        if (GET_INCH(in[pos + 1]) != s->inch || s->state == SI8900_SCOPE_IDLE)
+        {
+            pos += SI8900_FRAME_LEN;
+            continue;
+        }
+        x = GET_READING(PACKET_JOIN(in[pos + 1], in[pos + 2]));
+        pos += SI8900_FRAME_LEN;
+
+        s->ring[s->wpos] = x;
+        s->wpos = (s->wpos + 1) & (SI8900_SCOPE_DEPTH - 1);
+
+        if (s->state == SI8900_SCOPE_TRIGGERED)
+        {
+            if (--s->post_left == 0)
+            {
+                s->state = SI8900_SCOPE_READY;
+            }
+        }
+        else if (s->filled < s->pre)
+        {
+            s->filled++;
+        }
+        else
+        {
+            switch (s->trig)
+            {
+            case SI8900_TRIG_ABOVE:   hit = (x >= s->level); break;
+            case SI8900_TRIG_BELOW:   hit = (x <= s->level); break;
+            case SI8900_TRIG_RISING:  hit = (s->prev < s->level && x >= s->level); break;
+            default:                  hit = (s->prev > s->level && x <= s->level); break;
+            }
+            if (!hit && s->mode == SI8900_ARM_AUTO && ++s->waited >= s->auto_timeout)
+            {
+                hit = 1;
+                s->forced = 1;
+            }
+            if (hit)
+            {
+                s->post_left = s->post - 1; // trigger reading is the first post reading
+                s->state = s->post_left ? SI8900_SCOPE_TRIGGERED : SI8900_SCOPE_READY;
+            }
+        }
+        s->prev = x;
+    }
+
+    if (consumed)
+    {
+        *consumed = pos;
+    }
+    return s->state == SI8900_SCOPE_READY;
+}
+
+
+/*
+ *  name: si8900_scope_read
+ *
+ *  desc: copies a finished capture out as one contiguous array and re-arms
+ *        the scope unless it is in SI8900_ARM_SINGLE
+ *
+ *  args:
+ *      si8900_scope* s : scope
+ *      uint16_t* out   : pre + post readings out, trigger reading at index pre
+ *      uint8_t* forced : set to 1 if the capture was forced by SI8900_ARM_AUTO,
+ *                        0 otherwise, may be NULL
+ *
+ *  return value:
+ *      uint16_t: readings copied, 0 when no capture is ready
+ *
+ *  example:
+ *      uint16_t trace[SI8900_SCOPE_DEPTH];
+ *      uint8_t forced;
+ *      uint16_t n = si8900_scope_read(&scope, trace, &forced);
+ */
+uint16_t si8900_scope_read(si8900_scope* s, uint16_t* out, uint8_t* forced)
+{
+    uint16_t n = s->pre + s->post, i;
+    uint16_t rpos = (uint16_t)((s->wpos - n) & (SI8900_SCOPE_DEPTH - 1));
+
+    if (s->state != SI8900_SCOPE_READY)
+    {
+        return 0;
+    }
+    for (i = 0; i < n; i++)
+    {
+        out[i] = s->ring[rpos];
+        rpos = (rpos + 1) & (SI8900_SCOPE_DEPTH - 1);
+    }
+    if (forced)
+    {
+        *forced = s->forced;
+    }
+
+    if (s->mode == SI8900_ARM_SINGLE)
+    {
+        s->state = SI8900_SCOPE_IDLE;
+    }
+    else
+    {
+        si8900_scope_arm(s);
+    }
+    return n;
+}
@@ -0,0 +1,114 @@
+/*
+ * si8900_scope.h
+ * oscilloscope style triggered capture on top of the si8900 stream decoder.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  si8900_scope_decode decodes raw bytes like si8900_decode_frames, but
+ *  keeps only the readings of the chosen INCH in a circular buffer and
+ *  runs the trigger compare inline on every one, so the capture rate is
+ *  only bound by the UART.
+ *
+ *  Triggers:
+ *      SI8900_TRIG_ABOVE   : level, fires on a reading >= level
+ *      SI8900_TRIG_BELOW   : level, fires on a reading <= level
+ *      SI8900_TRIG_RISING  : edge, fires when readings cross level going up
+ *      SI8900_TRIG_FALLING : edge, fires when readings cross level going down
+ *
+ *  Arm modes:
+ *      SI8900_ARM_SINGLE : one capture, then idle until si8900_scope_arm
+ *      SI8900_ARM_NORMAL : re-arms after every capture is read
+ *      SI8900_ARM_AUTO   : as normal, but forces a trigger when none came
+ *                          within auto_timeout readings (free running view)
+ *
+ *  A trigger is only taken once pre readings have been collected since
+ *  arming, so every capture is pre + post readings with the trigger
+ *  reading at index pre.
+ *
+ *  Optional values: -- define in build config
+ *      SI8900_SCOPE_DEPTH : capture buffer, power of 2 >= pre + post (default 256)
+ */
+
+#ifndef si8900_scope_H_
+#define si8900_scope_H_
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+#ifndef SI8900_SCOPE_DEPTH
+    #define SI8900_SCOPE_DEPTH  256
+#endif
+
+#if (SI8900_SCOPE_DEPTH & (SI8900_SCOPE_DEPTH - 1))
+    #error "SI8900_SCOPE_DEPTH must be a power of 2."
+#endif
+
+
+/*
+ * trigger types
+ */
+#define SI8900_TRIG_ABOVE       0
+#define SI8900_TRIG_BELOW       1
+#define SI8900_TRIG_RISING      2
+#define SI8900_TRIG_FALLING     3
+
+
+/*
+ * arm modes
+ */
+#define SI8900_ARM_SINGLE       0
+#define SI8900_ARM_NORMAL       1
+#define SI8900_ARM_AUTO         2
+
+
+/*
+ * scope states
+ */
+#define SI8900_SCOPE_IDLE       0
+#define SI8900_SCOPE_ARMED      1
+#define SI8900_SCOPE_TRIGGERED  2
+#define SI8900_SCOPE_READY      3
+
+
+/*
+ * SCOPE STATE
+ */
+typedef struct si8900_scope{
+    /* configuration */
+    uint8_t inch;                       // channel number (0-2) to capture
+    uint8_t trig;                       // SI8900_TRIG_x
+    uint8_t mode;                       // SI8900_ARM_x
+    uint16_t level;                     // trigger level, reading counts
+    uint16_t pre;                       // readings kept before the trigger
+    uint16_t post;                      // readings kept from the trigger on
+    uint32_t auto_timeout;              // SI8900_ARM_AUTO only
+
+    /* capture */
+    uint16_t ring[SI8900_SCOPE_DEPTH];
+    uint16_t wpos;                      // next ring slot to write
+    uint16_t filled;                    // readings since arming, up to pre
+    uint16_t post_left;                 // readings still to take after the trigger
+    uint16_t prev;                      // previous reading, for edge triggers
+    uint32_t waited;                    // readings since the pre buffer filled
+    uint8_t state;                      // SI8900_SCOPE_x
+    uint8_t forced;                     // current capture was forced by SI8900_ARM_AUTO
+}si8900_scope;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_scope_init(si8900_scope*, uint8_t, uint8_t, uint16_t, uint16_t, uint16_t, uint8_t, uint32_t);
+void si8900_scope_arm(si8900_scope*);
+uint8_t si8900_scope_decode(si8900_scope*, const uint8_t*, size_t, size_t*);
+uint16_t si8900_scope_read(si8900_scope*, uint16_t*, uint8_t*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_scope_H_ */
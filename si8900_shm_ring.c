@@ -0,0 +1,406 @@
+/*
+ * si8900_shm_ring.c
+ * implementation file for the si8900 shared memory broadcast ring.
+ * Author: Danyal Ahsanullah
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include "si8900_shm_ring.h" // includes "si8900.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ *  name: si8900_ring_slot_at
+ *
+ *  desc: slot holding batch 'seq'
+ */
+static si8900_ring_slot* si8900_ring_slot_at(const si8900_ring* r, uint64_t seq)
+{
+    return (si8900_ring_slot*)(r->slots + (seq & (r->hdr->slots - 1)) * r->hdr->slot_bytes);
+}
+
+
+/*
+ *  name: si8900_ring_retire
+ *
+ *  desc: marks a ring left under 'name' by an earlier writer retired so
+ *        its readers move on, returns its epoch (0 when there is none)
+ */
+static uint64_t si8900_ring_retire(const char* name)
+{
+    struct stat st;
+    si8900_ring_hdr* hdr;
+    uint64_t epoch = 0;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(si8900_ring_hdr))
+    {
+        hdr = (si8900_ring_hdr*)mmap(NULL, sizeof(si8900_ring_hdr), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (hdr != MAP_FAILED)
+        {
+            if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) == SI8900_RING_MAGIC &&
+                hdr->version == SI8900_RING_VERSION)
+            {
+                epoch = hdr->epoch;
+                __atomic_store_n(&hdr->retired, 1, __ATOMIC_RELEASE);
+            }
+            munmap(hdr, sizeof(si8900_ring_hdr));
+        }
+    }
+    close(fd);
+    return epoch;
+}
+
+
+/*
+ *  name: si8900_ring_create
+ *
+ *  desc: creates (or replaces) a named ring and maps it for writing.
+ *        A ring left by an earlier writer is retired and unlinked, never
+ *        truncated, so readers still mapping it keep working and move to
+ *        the new ring on their own. Only one writer may use a ring.
+ *
+ *  args:
+ *      si8900_ring* r : handle to fill
+ *      const char* name : shared memory name, eg: "/si8900_dev0"
+ *      uint32_t slots : batches held, power of 2
+ *      uint32_t batch : readings per batch
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on bad sizes or a system error
+ *
+ *  example:
+ *      si8900_ring ring;
+ *      si8900_ring_create(&ring, "/si8900_dev0", 1024, 256);
+ */
+uint8_t si8900_ring_create(si8900_ring* r, const char* name, uint32_t slots, uint32_t batch)
+{
+    uint64_t slot_bytes = (sizeof(si8900_ring_slot) + (uint64_t)batch * sizeof(si8900_reading) + 63) & ~(uint64_t)63;
+    size_t len = sizeof(si8900_ring_hdr) + (size_t)(slot_bytes * slots);
+    uint64_t epoch;
+    void* map;
+    int fd;
+
+    r->hdr = NULL;
+    if (!slots || (slots & (slots - 1)) || !batch)
+    {
+        return FAILED;
+    }
+    epoch = si8900_ring_retire(name) + 1;
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        return FAILED;
+    }
+    if (ftruncate(fd, (off_t)len) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return FAILED;
+    }
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return FAILED;
+    }
+
+    r->hdr = (si8900_ring_hdr*)map;
+    r->slots = (uint8_t*)map + sizeof(si8900_ring_hdr);
+    r->map_len = len;
+    r->cursor = 0;
+    r->epoch = epoch;
+    r->writer = 1;
+    r->name[0] = '\0';
+
+    // the object is new and zero filled: head 0, not retired
+    r->hdr->slots = slots;
+    r->hdr->batch = batch;
+    r->hdr->slot_bytes = slot_bytes;
+    r->hdr->version = SI8900_RING_VERSION;
+    r->hdr->epoch = epoch;
+    // readers check the magic last, publish it after everything else
+    __atomic_store_n(&r->hdr->magic, SI8900_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_ring_open
+ *
+ *  desc: maps an existing ring read only. The reader starts at the
+ *        newest batch, older ones are not replayed. The name is kept so
+ *        the reader can follow the ring when its writer is restarted.
+ *
+ *  args:
+ *      si8900_ring* r   : handle to fill
+ *      const char* name : shared memory name given to si8900_ring_create
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED when the ring does not exist,
+ *      is not a ring of this version, has been retired or the name is
+ *      longer than SI8900_RING_NAME_LEN - 1
+ *
+ *  example:
+ *      si8900_ring ring;
+ *      if (si8900_ring_open(&ring, "/si8900_dev0")) { ... }
+ */
+uint8_t si8900_ring_open(si8900_ring* r, const char* name)
+{
+    struct stat st;
+    void* map;
+    int fd;
+
+    r->hdr = NULL;
+    if (strlen(name) >= SI8900_RING_NAME_LEN)
+    {
+        return FAILED;
+    }
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return FAILED;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(si8900_ring_hdr))
+    {
+        close(fd);
+        return FAILED;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return FAILED;
+    }
+
+    r->hdr = (si8900_ring_hdr*)map;
+    r->map_len = (size_t)st.st_size;
+    if (__atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != SI8900_RING_MAGIC ||
+        r->hdr->version != SI8900_RING_VERSION ||
+        sizeof(si8900_ring_hdr) + r->hdr->slot_bytes * r->hdr->slots > r->map_len ||
+        __atomic_load_n(&r->hdr->retired, __ATOMIC_ACQUIRE))
+    {
+        si8900_ring_close(r);
+        return FAILED;
+    }
+    r->slots = (uint8_t*)map + sizeof(si8900_ring_hdr);
+    r->epoch = r->hdr->epoch;
+    r->cursor = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    r->writer = 0;
+    strcpy(r->name, name);
+    return 0;
+}
+
+
+/*
+ *  name: si8900_ring_reattach
+ *
+ *  desc: swaps a retired ring for the one now under the same name,
+ *        starting at its oldest batch. Keeps the old ring when there is
+ *        no new one yet.
+ */
+static uint8_t si8900_ring_reattach(si8900_ring* r)
+{
+    si8900_ring fresh;
+
+    if (si8900_ring_open(&fresh, r->name))
+    {
+        return FAILED;
+    }
+    si8900_ring_close(r);
+    *r = fresh;
+    r->cursor = 0; // lapped handling skips to the oldest batch held
+    return 0;
+}
+
+
+/*
+ *  name: si8900_ring_close
+ *
+ *  desc: unmaps a ring, the shared memory stays until si8900_ring_unlink
+ *
+ *  args:
+ *      si8900_ring* r : handle
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_ring_close(&ring);
+ */
+void si8900_ring_close(si8900_ring* r)
+{
+    if (r->hdr)
+    {
+        munmap(r->hdr, r->map_len);
+        r->hdr = NULL;
+    }
+}
+
+
+/*
+ *  name: si8900_ring_unlink
+ *
+ *  desc: removes a ring name, mapped handles stay valid until closed
+ *
+ *  args:
+ *      const char* name : shared memory name
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_ring_unlink("/si8900_dev0");
+ */
+void si8900_ring_unlink(const char* name)
+{
+    shm_unlink(name);
+}
+
+
+/*
+ *  name: si8900_ring_publish
+ *
+ *  desc: publishes readings, split into batches of at most 'batch'
+ *
+ *  args:
+ *      si8900_ring* r             : writer handle
+ *      const si8900_reading* in   : readings to publish
+ *      size_t n                   : number of readings
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      n = si8900_decode_frames(rx_buf, rx_len, readings, 256, &used);
+ *      si8900_ring_publish(&ring, readings, n);
+ */
+void si8900_ring_publish(si8900_ring* r, const si8900_reading* in, size_t n)
+{
+    while (n)
+    {
+        uint32_t count = (n > r->hdr->batch) ? r->hdr->batch : (uint32_t)n;
+        uint64_t seq = r->cursor;
+        si8900_ring_slot* slot = si8900_ring_slot_at(r, seq);
+
+        __atomic_store_n(&slot->stamp, 2 * seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE); // busy mark lands before the data
+        slot->count = count;
+        memcpy(slot + 1, in, count * sizeof(si8900_reading));
+        __atomic_store_n(&slot->stamp, 2 * seq + 2, __ATOMIC_RELEASE);
+        __atomic_store_n(&r->hdr->head, seq + 1, __ATOMIC_RELEASE);
+
+        r->cursor = seq + 1;
+        in += count;
+        n -= count;
+    }
+}
+
+
+/*
+ *  name: si8900_ring_read
+ *
+ *  desc: copies the next batch for this reader
+ *
+ *  args:
+ *      si8900_ring* r       : reader handle
+ *      si8900_reading* out  : room for 'batch' readings (r->hdr->batch)
+ *      uint64_t* lost       : set to the batches skipped because this reader
+ *                             was lapped (0 normally), may be NULL
+ *
+ *  When the ring was retired by a restarted writer the reader first drains
+ *  it, then reattaches to the new ring (a shm_open, only on that path).
+ *
+ *  return value:
+ *      uint32_t: readings copied, 0 when no new batch is available
+ *
+ *  example:
+ *      uint64_t lost;
+ *      while ((n = si8900_ring_read(&ring, readings, &lost)) != 0)
+ *      {
+ *          if (lost) note_gap(lost);
+ *          log_readings(readings, n);
+ *      }
+ */
+uint32_t si8900_ring_read(si8900_ring* r, si8900_reading* out, uint64_t* lost)
+{
+    uint64_t skipped = 0;
+
+    for (;;)
+    {
+        uint64_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+        uint64_t seq = r->cursor;
+        si8900_ring_slot* slot;
+        uint64_t stamp;
+        uint32_t count;
+
+        if (seq > head || r->hdr->epoch != r->epoch)
+        {
+            // ring re-initialised under this reader, start over at its oldest batch
+            r->epoch = r->hdr->epoch;
+            r->cursor = 0;
+            continue;
+        }
+        if (seq == head)
+        {
+            if (__atomic_load_n(&r->hdr->retired, __ATOMIC_ACQUIRE) && si8900_ring_reattach(r) == 0)
+            {
+                continue;
+            }
+            if (lost)
+            {
+                *lost = skipped;
+            }
+            return 0;
+        }
+        if (head - seq > r->hdr->slots)
+        {
+            // lapped, jump to the oldest batch still held
+            skipped += head - r->hdr->slots - seq;
+            r->cursor = head - r->hdr->slots;
+            continue;
+        }
+
+        slot = si8900_ring_slot_at(r, seq);
+        stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+        if (stamp != 2 * seq + 2)
+        {
+            // overwritten since head was read
+            skipped++;
+            r->cursor = seq + 1;
+            continue;
+        }
+        count = slot->count;
+        if (count > r->hdr->batch)
+        {
+            count = r->hdr->batch;
+        }
+        memcpy(out, slot + 1, count * sizeof(si8900_reading));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // copy completes before the re-check
+        if (__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) != stamp)
+        {
+            skipped++;
+            r->cursor = seq + 1;
+            continue;
+        }
+
+        r->cursor = seq + 1;
+        if (lost)
+        {
+            *lost = skipped;
+        }
+        return count;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * si8900_shm_ring.h
+ * shared memory broadcast ring of decoded si8900 readings (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option and POSIX shared memory (link -lrt on
+ *  older glibc).
+ *
+ *  One acquisition process creates the ring and publishes batches of
+ *  si8900_reading into fixed size slots. Any number of processes open it
+ *  read only and each keeps its own cursor, so readers never hold up the
+ *  writer or each other. Everything after open is plain loads and stores
+ *  on the mapping -- no syscalls on the hot path.
+ *
+ *  Every slot carries the sequence number of the batch in it. The writer
+ *  marks a slot busy (odd) before filling it and stamps it (even) after,
+ *  then advances the ring head. A reader checks the stamp before and after
+ *  copying; a reader that fell more than a ring behind, or was overtaken
+ *  mid copy, is told how many batches it lost and skips to the oldest
+ *  batch still held.
+ *
+ *  A new writer never resizes a ring under its readers (that would fault
+ *  them): it marks the old ring retired, unlinks the name and creates a
+ *  fresh object with the next epoch. Readers drain what the old ring still
+ *  holds, then reattach to the new one by name and start at its oldest
+ *  batch. Batches published while no ring was attached are not counted as
+ *  lost. A reader that finds the epoch changed under it, or its cursor
+ *  past the head, resyncs the same way.
+ */
+
+#ifndef si8900_shm_ring_H_
+#define si8900_shm_ring_H_
+
+#ifndef PC_
+    #error "si8900_shm_ring is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900.h" // includes <stdint.h>, <stddef.h>
+
+
+#define SI8900_RING_MAGIC   0x53393052UL    // "S90R"
+#define SI8900_RING_VERSION 2
+
+#ifndef SI8900_RING_NAME_LEN
+    #define SI8900_RING_NAME_LEN    64      // longest name kept for reattaching, with the '\0'
+#endif
+
+
+/*
+ * SHARED HEADER -- first cache line of the mapping
+ */
+typedef struct si8900_ring_hdr{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;         // power of 2
+    uint32_t batch;         // readings per slot
+    uint64_t slot_bytes;    // stride between slots
+    uint64_t head;          // batches published, written by the writer only
+    uint64_t epoch;         // one more than the ring this one replaced
+    uint32_t retired;       // set by the next writer, no more batches will come
+    uint8_t pad[20];
+}si8900_ring_hdr;
+
+
+/*
+ * SLOT HEADER -- followed by 'batch' readings
+ */
+typedef struct si8900_ring_slot{
+    uint64_t stamp;         // 2 * seq + 1 while filling, 2 * seq + 2 when done
+    uint32_t count;         // readings in this batch
+    uint32_t pad;
+}si8900_ring_slot;
+
+
+/*
+ * PROCESS LOCAL HANDLE
+ */
+typedef struct si8900_ring{
+    si8900_ring_hdr* hdr;
+    uint8_t* slots;         // first slot
+    size_t map_len;
+    uint64_t cursor;        // next batch to read (readers) or write (writer)
+    uint64_t epoch;         // epoch of the mapped ring
+    uint8_t writer;
+    char name[SI8900_RING_NAME_LEN];
+}si8900_ring;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_ring_create(si8900_ring*, const char*, uint32_t, uint32_t);
+uint8_t si8900_ring_open(si8900_ring*, const char*);
+void si8900_ring_close(si8900_ring*);
+void si8900_ring_unlink(const char*);
+void si8900_ring_publish(si8900_ring*, const si8900_reading*, size_t);
+uint32_t si8900_ring_read(si8900_ring*, si8900_reading*, uint64_t*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_shm_ring_H_ */
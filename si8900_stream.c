@@ -0,0 +1,476 @@
+/*
+ * si8900_stream.c
+ * implementation file for the si8900 unix socket streaming server.
+ * Author: Danyal Ahsanullah
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "si8900_stream.h" // includes "si8900_block.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SI8900_STREAM_MASK (SI8900_STREAM_QUEUE - 1)
+
+
+/*
+ *  name: si8900_stream_drop_sub
+ *
+ *  desc: closes a subscriber and frees its entry
+ */
+static void si8900_stream_drop_sub(si8900_stream* s, si8900_stream_sub* sub)
+{
+    close(sub->fd);
+    free(sub->q);
+    sub->fd = -1;
+    sub->q = NULL;
+    s->n_subs--;
+}
+
+
+/*
+ *  name: si8900_stream_flush_sub
+ *
+ *  desc: writes as many queued frames as the socket takes
+ *
+ *  return value:
+ *      uint8_t with value 0 while the subscriber is healthy,
+ *      FAILED when the connection is gone
+ */
+static uint8_t si8900_stream_flush_sub(si8900_stream_sub* sub)
+{
+    struct iovec iov[2 * SI8900_STREAM_IOV];
+    struct msghdr msg;
+    ssize_t n;
+
+    while (sub->head != sub->tail)
+    {
+        size_t skip = sub->sent;
+        uint32_t i;
+        int n_iov = 0;
+
+        for (i = sub->head; i != sub->tail && n_iov + 2 <= 2 * SI8900_STREAM_IOV; i++)
+        {
+            si8900_stream_frame* f = &sub->q[i & SI8900_STREAM_MASK];
+            size_t plen = f->hdr.count * sizeof(uint16_t);
+
+            if (skip < sizeof(si8900_stream_hdr))
+            {
+                iov[n_iov].iov_base = (uint8_t*)&f->hdr + skip;
+                iov[n_iov].iov_len = sizeof(si8900_stream_hdr) - skip;
+                n_iov++;
+                skip = 0;
+            }
+            else
+            {
+                skip -= sizeof(si8900_stream_hdr);
+            }
+            iov[n_iov].iov_base = (uint8_t*)f->reading + skip;
+            iov[n_iov].iov_len = plen - skip;
+            n_iov++;
+            skip = 0;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n_iov;
+        n = sendmsg(sub->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : FAILED;
+        }
+
+        // retire whole frames, remember how far into the next one we got
+        while (n > 0)
+        {
+            si8900_stream_frame* f = &sub->q[sub->head & SI8900_STREAM_MASK];
+            size_t left = sizeof(si8900_stream_hdr) + f->hdr.count * sizeof(uint16_t) - sub->sent;
+
+            if ((size_t)n >= left)
+            {
+                n -= (ssize_t)left;
+                sub->head++;
+                sub->sent = 0;
+            }
+            else
+            {
+                sub->sent += (size_t)n;
+                n = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_stream_queue
+ *
+ *  desc: queues one frame for a subscriber, applying the drop policy
+ *        when its queue is full
+ *
+ *  return value:
+ *      uint8_t with value 0 while the subscriber is healthy,
+ *      FAILED when it has to be disconnected
+ */
+static uint8_t si8900_stream_queue(si8900_stream* s, si8900_stream_sub* sub, const si8900_stream_hdr* hdr, const uint16_t* in)
+{
+    si8900_stream_frame* f;
+
+    if (sub->tail - sub->head == SI8900_STREAM_QUEUE)
+    {
+        sub->dropped++;
+        if (s->policy == SI8900_DROP_DISCONNECT)
+        {
+            return FAILED;
+        }
+        if (s->policy == SI8900_DROP_NEWEST)
+        {
+            sub->lost++;
+            return 0;
+        }
+        // SI8900_DROP_OLDEST: a frame already partly on the wire has to
+        // finish, so drop the one behind it by moving the head frame up.
+        // The dropped frame's own lost count carries over.
+        f = &sub->q[(sub->head + (sub->sent ? 1 : 0)) & SI8900_STREAM_MASK];
+        sub->lost += f->hdr.lost + 1;
+        if (sub->sent)
+        {
+            memcpy(f, &sub->q[sub->head & SI8900_STREAM_MASK], sizeof(si8900_stream_frame));
+        }
+        sub->head++;
+    }
+
+    f = &sub->q[sub->tail & SI8900_STREAM_MASK];
+    f->hdr = *hdr;
+    f->hdr.lost = sub->lost;
+    memcpy(f->reading, in, hdr->count * sizeof(uint16_t));
+    sub->lost = 0;
+    sub->tail++;
+    return 0;
+}
+
+
+/*
+ *  name: si8900_stream_init
+ *
+ *  desc: creates the listening socket, replacing a stale socket file
+ *
+ *  args:
+ *      si8900_stream* s : server to set up
+ *      const char* path : socket path, eg: "/run/si8900.sock"
+ *      uint8_t policy   : SI8900_DROP_NEWEST, SI8900_DROP_OLDEST or
+ *                         SI8900_DROP_DISCONNECT
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a bad path or system error
+ *
+ *  example:
+ *      si8900_stream srv;
+ *      si8900_stream_init(&srv, "/run/si8900.sock", SI8900_DROP_OLDEST);
+ */
+uint8_t si8900_stream_init(si8900_stream* s, const char* path, uint8_t policy)
+{
+    struct sockaddr_un addr;
+    uint32_t i;
+
+    s->listen_fd = -1;
+    s->policy = policy;
+    s->n_subs = 0;
+    for (i = 0; i < SI8900_STREAM_MAX_SUBS; i++)
+    {
+        s->sub[i].fd = -1;
+        s->sub[i].q = NULL;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path) || policy > SI8900_DROP_DISCONNECT)
+    {
+        return FAILED;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    s->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s->listen_fd < 0)
+    {
+        return FAILED;
+    }
+    if (bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(s->listen_fd, SI8900_STREAM_MAX_SUBS) != 0 ||
+        fcntl(s->listen_fd, F_SETFL, O_NONBLOCK) != 0)
+    {
+        close(s->listen_fd);
+        s->listen_fd = -1;
+        return FAILED;
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_stream_close
+ *
+ *  desc: disconnects every subscriber and closes the listening socket.
+ *        The socket file is left for the caller to unlink.
+ *
+ *  args:
+ *      si8900_stream* s : server
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_stream_close(&srv);
+ */
+void si8900_stream_close(si8900_stream* s)
+{
+    uint32_t i;
+
+    for (i = 0; i < SI8900_STREAM_MAX_SUBS; i++)
+    {
+        if (s->sub[i].fd >= 0)
+        {
+            si8900_stream_drop_sub(s, &s->sub[i]);
+        }
+    }
+    if (s->listen_fd >= 0)
+    {
+        close(s->listen_fd);
+        s->listen_fd = -1;
+    }
+}
+
+
+/*
+ *  name: si8900_stream_accept
+ *
+ *  desc: accepts every pending connection. Connections beyond
+ *        SI8900_STREAM_MAX_SUBS are closed straight away.
+ *
+ *  args:
+ *      si8900_stream* s : server
+ *
+ *  return value:
+ *      uint32_t: number of subscribers added
+ *
+ *  example:
+ *      if (fds[0].revents & POLLIN)
+ *      {
+ *          si8900_stream_accept(&srv);
+ *      }
+ */
+uint32_t si8900_stream_accept(si8900_stream* s)
+{
+    uint32_t added = 0, i;
+    int fd;
+
+    while ((fd = accept(s->listen_fd, NULL, NULL)) >= 0)
+    {
+        si8900_stream_sub* sub = NULL;
+
+        for (i = 0; i < SI8900_STREAM_MAX_SUBS; i++)
+        {
+            if (s->sub[i].fd < 0)
+            {
+                sub = &s->sub[i];
+                break;
+            }
+        }
+        if (!sub || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+            (sub->q = (si8900_stream_frame*)malloc(SI8900_STREAM_QUEUE * sizeof(si8900_stream_frame))) == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        sub->fd = fd;
+        sub->head = sub->tail = 0;
+        sub->sent = 0;
+        sub->lost = 0;
+        sub->dropped = 0;
+        s->n_subs++;
+        added++;
+    }
+    return added;
+}
+
+
+/*
+ *  name: si8900_stream_enqueue
+ *
+ *  desc: splits readings into frames and queues them for every subscriber
+ */
+static void si8900_stream_enqueue(si8900_stream* s, uint16_t dev, uint8_t ch, si8900_tstamp first, si8900_tstamp dt, const uint16_t* in, size_t n)
+{
+    si8900_stream_hdr hdr;
+    uint32_t i;
+
+    hdr.magic = SI8900_STREAM_MAGIC;
+    hdr.dev = dev;
+    hdr.ch = ch;
+    hdr.version = SI8900_STREAM_VERSION;
+    hdr.lost = 0;
+    hdr.first_tstamp = first;
+
+    while (n)
+    {
+        hdr.count = (n > SI8900_STREAM_BATCH) ? SI8900_STREAM_BATCH : (uint32_t)n;
+        for (i = 0; i < SI8900_STREAM_MAX_SUBS; i++)
+        {
+            if (s->sub[i].fd >= 0 && si8900_stream_queue(s, &s->sub[i], &hdr, in))
+            {
+                si8900_stream_drop_sub(s, &s->sub[i]);
+            }
+        }
+        hdr.first_tstamp += dt * hdr.count;
+        in += hdr.count;
+        n -= hdr.count;
+    }
+}
+
+
+/*
+ *  name: si8900_stream_send
+ *
+ *  desc: queues readings of one channel for every subscriber, in frames of
+ *        at most SI8900_STREAM_BATCH, then flushes what the sockets take
+ *
+ *  args:
+ *      si8900_stream* s        : server
+ *      uint16_t dev            : device id for the frame header
+ *      uint8_t ch              : channel
+ *      si8900_tstamp first     : time of in[0]
+ *      si8900_tstamp dt        : time between readings, used to stamp the
+ *                                frames after the first (0 if unknown)
+ *      const uint16_t* in      : readings
+ *      size_t n                : number of readings
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_stream_send(&srv, 0, 1, t0, period_ns, samples, n);
+ */
+void si8900_stream_send(si8900_stream* s, uint16_t dev, uint8_t ch, si8900_tstamp first, si8900_tstamp dt, const uint16_t* in, size_t n)
+{
+    if (!s->n_subs)
+    {
+        return;
+    }
+    si8900_stream_enqueue(s, dev, ch, first, dt, in, n);
+    si8900_stream_flush(s);
+}
+
+
+/*
+ *  name: si8900_stream_send_block
+ *
+ *  desc: streams every channel of a block with a single flush. The
+ *        reading period comes from the block timestamps (SI8900_TSTAMP_),
+ *        without them frames are stamped 0.
+ *
+ *  args:
+ *      si8900_stream* s         : server
+ *      uint16_t dev             : device id for the frame headers
+ *      const si8900_block* blk  : block to send
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_decode_block(rx_buf, rx_len, &blk, &used);
+ *      si8900_stream_send_block(&srv, 0, &blk);
+ */
+void si8900_stream_send_block(si8900_stream* s, uint16_t dev, const si8900_block* blk)
+{
+    uint16_t n;
+    uint8_t ch;
+
+    if (!s->n_subs)
+    {
+        return;
+    }
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        n = blk->count[ch];
+        if (!n)
+        {
+            continue;
+        }
+#ifdef SI8900_TSTAMP_
+        si8900_stream_enqueue(s, dev, ch, blk->tstamp[ch][0],
+                              (n > 1) ? (blk->tstamp[ch][n - 1] - blk->tstamp[ch][0]) / (n - 1) : 0,
+                              blk->reading[ch], n);
+#else
+        si8900_stream_enqueue(s, dev, ch, 0, 0, blk->reading[ch], n);
+#endif
+    }
+    si8900_stream_flush(s);
+}
+
+
+/*
+ *  name: si8900_stream_flush
+ *
+ *  desc: sends queued frames to every subscriber without blocking,
+ *        subscribers whose connection is gone are dropped
+ *
+ *  args:
+ *      si8900_stream* s : server
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      // on POLLOUT for any subscriber fd
+ *      si8900_stream_flush(&srv);
+ */
+void si8900_stream_flush(si8900_stream* s)
+{
+    uint32_t i;
+
+    for (i = 0; i < SI8900_STREAM_MAX_SUBS; i++)
+    {
+        if (s->sub[i].fd >= 0 && si8900_stream_flush_sub(&s->sub[i]))
+        {
+            si8900_stream_drop_sub(s, &s->sub[i]);
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_stream_pending
+ *
+ *  desc: tells whether a subscriber still has queued data, ie: whether its
+ *        fd should be polled for POLLOUT
+ *
+ *  args:
+ *      const si8900_stream* s : server
+ *      uint32_t i             : subscriber index, < SI8900_STREAM_MAX_SUBS
+ *
+ *  return value:
+ *      uint8_t: 1 when frames are queued, 0 otherwise or for a free entry
+ *
+ *  example:
+ *      for (i = 0; i < SI8900_STREAM_MAX_SUBS; i++)
+ *      {
+ *          fds[i + 1].fd = srv.sub[i].fd;
+ *          fds[i + 1].events = si8900_stream_pending(&srv, i) ? POLLOUT : 0;
+ *      }
+ */
+uint8_t si8900_stream_pending(const si8900_stream* s, uint32_t i)
+{
+    return (s->sub[i].fd >= 0 && s->sub[i].head != s->sub[i].tail) ? 1 : 0;
+}
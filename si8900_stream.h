@@ -0,0 +1,126 @@
+/*
+ * si8900_stream.h
+ * unix domain socket streaming server for si8900 readings (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option.
+ *
+ *  For tools that can not map the shared memory ring. Subscribers connect
+ *  to a SOCK_STREAM unix socket and receive back to back frames:
+ *      si8900_stream_hdr (24 bytes) then count * uint16_t readings
+ *  in host byte order -- the socket is local, both ends share a machine.
+ *
+ *  Readings are queued per subscriber as whole frames and sent with one
+ *  sendmsg per flush carrying as many queued frames as fit in
+ *  SI8900_STREAM_IOV iovecs, so a syscall moves thousands of readings.
+ *  Sockets are non blocking; a subscriber that does not keep up fills its
+ *  own queue and then the server's drop policy applies to it alone:
+ *      SI8900_DROP_NEWEST     : discard the incoming frame
+ *      SI8900_DROP_OLDEST     : discard the oldest frame not yet started
+ *      SI8900_DROP_DISCONNECT : close the subscriber
+ *  Frames lost to a policy are reported in the 'lost' field of the next
+ *  frame queued for that subscriber.
+ *
+ *  The server is driven from the caller's loop: poll listen_fd for
+ *  POLLIN (si8900_stream_accept) and subscriber fds with queued data for
+ *  POLLOUT (si8900_stream_flush). Nothing is read from subscribers.
+ */
+
+#ifndef si8900_stream_H_
+#define si8900_stream_H_
+
+#ifndef PC_
+    #error "si8900_stream is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h", si8900_tstamp
+
+
+#ifndef SI8900_STREAM_BATCH
+    #define SI8900_STREAM_BATCH 1024  // max readings per frame
+#endif
+#ifndef SI8900_STREAM_QUEUE
+    #define SI8900_STREAM_QUEUE 64    // frames queued per subscriber, power of 2
+#endif
+#ifndef SI8900_STREAM_MAX_SUBS
+    #define SI8900_STREAM_MAX_SUBS 16
+#endif
+#define SI8900_STREAM_IOV 32          // frames per sendmsg
+
+#define SI8900_STREAM_MAGIC   0x53393053UL // "S90S"
+#define SI8900_STREAM_VERSION 1
+
+#define SI8900_DROP_NEWEST     0
+#define SI8900_DROP_OLDEST     1
+#define SI8900_DROP_DISCONNECT 2
+
+
+/*
+ * WIRE HEADER
+ */
+typedef struct si8900_stream_hdr{
+    uint32_t magic;
+    uint16_t dev;           // device id given to si8900_stream_send
+    uint8_t ch;
+    uint8_t version;
+    uint32_t count;         // readings following the header
+    uint32_t lost;          // frames dropped for this subscriber before this one
+    uint64_t first_tstamp;  // time of the first reading
+}si8900_stream_hdr;
+
+
+/*
+ * QUEUED FRAME
+ */
+typedef struct si8900_stream_frame{
+    si8900_stream_hdr hdr;
+    uint16_t reading[SI8900_STREAM_BATCH];
+}si8900_stream_frame;
+
+
+/*
+ * SUBSCRIBER
+ */
+typedef struct si8900_stream_sub{
+    int fd;                     // -1 when the entry is free
+    si8900_stream_frame* q;     // SI8900_STREAM_QUEUE frames
+    uint32_t head;              // first queued frame
+    uint32_t tail;              // one past the last queued frame
+    size_t sent;                // bytes of q[head] already written
+    uint32_t lost;              // dropped since the last frame was queued
+    uint64_t dropped;           // dropped in total
+}si8900_stream_sub;
+
+
+/*
+ * SERVER
+ */
+typedef struct si8900_stream{
+    int listen_fd;
+    uint8_t policy;             // SI8900_DROP_xxx
+    uint32_t n_subs;
+    si8900_stream_sub sub[SI8900_STREAM_MAX_SUBS];
+}si8900_stream;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_stream_init(si8900_stream*, const char*, uint8_t);
+void si8900_stream_close(si8900_stream*);
+uint32_t si8900_stream_accept(si8900_stream*);
+void si8900_stream_send(si8900_stream*, uint16_t, uint8_t, si8900_tstamp, si8900_tstamp, const uint16_t*, size_t);
+void si8900_stream_send_block(si8900_stream*, uint16_t, const si8900_block*);
+void si8900_stream_flush(si8900_stream*);
+uint8_t si8900_stream_pending(const si8900_stream*, uint32_t);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_stream_H_ */
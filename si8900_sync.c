@@ -0,0 +1,473 @@
+/*
+ * si8900_sync.c
+ * implementation file for si8900 clock alignment.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_sync.h" // includes "si8900_block.h", "si8900_freq.h"
+
+#include <math.h>
+#include <string.h>
+
+
+/*
+ *  name: si8900_sync_predict
+ *
+ *  desc: predicted offset of a device at reference time t
+ */
+static double si8900_sync_predict(const si8900_sync_dev* d, si8900_tstamp t)
+{
+    return d->offset_ns + d->drift * (double)(int64_t)(t - d->t_fix);
+}
+
+
+/*
+ *  name: si8900_sync_filter
+ *
+ *  desc: alpha-beta update with one measured offset at reference time t
+ */
+static void si8900_sync_filter(si8900_sync* s, si8900_sync_dev* d, si8900_tstamp t, double meas)
+{
+    double dt, pred, r, n, alpha, beta, alpha_tau;
+
+    if (!d->pairs)
+    {
+        // first pair since (re)locking, the second one sets the drift
+        d->offset_ns = meas;
+        d->t_fix = t;
+        d->locked = 1;
+        d->pairs = 1;
+        return;
+    }
+    dt = (double)(int64_t)(t - d->t_fix);
+    if (dt <= 0.0)
+    {
+        return; // pairs come in time order, an old one adds nothing
+    }
+    pred = si8900_sync_predict(d, t);
+    r = meas - pred;
+    if (d->pairs >= SI8900_SYNC_SETTLE && fabs(r) > (double)s->gate_ns)
+    {
+        d->rejected++;
+        if (++d->missed >= SI8900_SYNC_RELOCK)
+        {
+            // lost track (eg: a lasting step in a device's latency), start over
+            d->offset_ns = meas;
+            d->t_fix = t;
+            d->pairs = 1;
+            d->missed = 0;
+        }
+        return;
+    }
+    d->missed = 0;
+
+    // expanding memory gains -- a least squares line through every pair so
+    // far -- until they fall below the time constant ones, which keep the
+    // Benedict-Bordner relation beta = alpha^2 / (2 - alpha)
+    n = (double)d->pairs + 1.0;
+    alpha = 2.0 * (2.0 * n - 1.0) / (n * (n + 1.0));
+    beta = 6.0 / (n * (n + 1.0));
+    alpha_tau = dt / (SI8900_SYNC_TAU_S * 1e9 + dt);
+    if (alpha < alpha_tau)
+    {
+        alpha = alpha_tau;
+        beta = alpha * alpha / (2.0 - alpha);
+    }
+    d->offset_ns = pred + alpha * r;
+    d->drift += beta * r / dt;
+    d->t_fix = t;
+    d->pairs++;
+}
+
+
+/*
+ *  name: si8900_sync_pair
+ *
+ *  desc: pairs a device's waiting edges with reference edges, as far as
+ *        the reference has got
+ */
+static void si8900_sync_pair(si8900_sync* s, si8900_sync_dev* d)
+{
+    uint32_t n_ref = (s->ref_head < SI8900_SYNC_REF_EDGES) ? s->ref_head : SI8900_SYNC_REF_EDGES;
+
+    while (d->pend_tail != d->pend_head && n_ref)
+    {
+        // work in differences to e, ns timestamps do not fit a double
+        si8900_tstamp e = d->pend[d->pend_tail & (SI8900_SYNC_PENDING - 1)];
+        si8900_tstamp newest = s->ref[(s->ref_head - 1) & (SI8900_SYNC_REF_EDGES - 1)];
+        double pred = d->locked ? si8900_sync_predict(d, e) : 0.0;
+        double dist, best_dist = -1.0;
+        si8900_tstamp best = 0;
+        uint32_t i;
+
+        if ((double)(int64_t)(newest - e) + pred < (double)s->match_ns)
+        {
+            break; // its partner may still be on the way
+        }
+        for (i = 0; i < n_ref; i++)
+        {
+            si8900_tstamp r = s->ref[(s->ref_head - 1 - i) & (SI8900_SYNC_REF_EDGES - 1)];
+            dist = fabs((double)(int64_t)(r - e) + pred);
+            if (best_dist < 0.0 || dist < best_dist)
+            {
+                best_dist = dist;
+                best = r;
+            }
+        }
+        if (best_dist <= (double)s->match_ns)
+        {
+            si8900_sync_filter(s, d, best, (double)(int64_t)(e - best));
+        }
+        d->pend_tail++;
+    }
+}
+
+
+/*
+ *  name: si8900_sync_init
+ *
+ *  desc: sets up alignment of n_dev devices to device 0
+ *
+ *  args:
+ *      si8900_sync* s          : service
+ *      uint8_t n_dev           : devices, <= SI8900_SYNC_MAX_DEV
+ *      uint8_t mode            : SI8900_SYNC_MAINS or SI8900_SYNC_PULSE
+ *      uint8_t inch            : channel carrying the shared signal
+ *      uint16_t level          : pulse threshold in counts (PULSE only)
+ *      si8900_tstamp match_ns  : largest offset paired before locking, and
+ *                                furthest a pair may be from the prediction
+ *      si8900_tstamp gate_ns   : largest residual accepted once settled
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on bad arguments
+ *
+ *  example:
+ *      si8900_sync sy;
+ *      si8900_sync_init(&sy, 3, SI8900_SYNC_MAINS, 2, 0, 8000000, 1000000);
+ */
+uint8_t si8900_sync_init(si8900_sync* s, uint8_t n_dev, uint8_t mode, uint8_t inch, uint16_t level, si8900_tstamp match_ns, si8900_tstamp gate_ns)
+{
+    uint8_t i;
+
+    memset(s, 0, sizeof(*s));
+    if (!n_dev || n_dev > SI8900_SYNC_MAX_DEV || mode > SI8900_SYNC_PULSE || inch >= SI8900_NUM_CH)
+    {
+        return FAILED;
+    }
+    s->n_dev = n_dev;
+    s->mode = mode;
+    s->inch = inch;
+    s->match_ns = match_ns;
+    s->gate_ns = gate_ns;
+    for (i = 0; i < n_dev; i++)
+    {
+        s->dev[i].level_q8 = (int32_t)level << 8;
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_sync_update
+ *
+ *  desc: feeds one device's timestamped readings, readings of other
+ *        channels are skipped
+ *
+ *  args:
+ *      si8900_sync* s            : service
+ *      uint8_t dev               : device, 0 is the reference
+ *      const si8900_reading* r   : readings
+ *      const si8900_tstamp* t    : their raw (uncorrected) timestamps
+ *      size_t n                  : number of readings
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_sync_update(&sy, dev, readings, stamps, n);
+ */
+void si8900_sync_update(si8900_sync* s, uint8_t dev, const si8900_reading* r, const si8900_tstamp* t, size_t n)
+{
+    si8900_sync_dev* d;
+    uint32_t warm_len = (s->mode == SI8900_SYNC_MAINS) ? (1UL << SI8900_FREQ_DC_SHIFT) : 1;
+    uint8_t edges = 0;
+    size_t i;
+
+    if (dev >= s->n_dev)
+    {
+        return;
+    }
+    d = &s->dev[dev];
+    for (i = 0; i < n; i++)
+    {
+        int32_t x_q8;
+
+        if (r[i].inch != s->inch)
+        {
+            continue;
+        }
+        x_q8 = (int32_t)r[i].reading << 8;
+        if (s->mode == SI8900_SYNC_MAINS)
+        {
+            if (!d->warm)
+            {
+                d->level_q8 = x_q8;
+            }
+            d->level_q8 += (x_q8 - d->level_q8) >> SI8900_FREQ_DC_SHIFT;
+        }
+
+        if (d->warm < warm_len)
+        {
+            d->warm++; // mains DC still settling, or no previous reading yet
+        }
+        else if (x_q8 < d->level_q8 - (SI8900_SYNC_HYST << 8))
+        {
+            d->armed = 1;
+        }
+        else if (d->armed && d->prev_q8 < d->level_q8 && x_q8 >= d->level_q8)
+        {
+            // rising edge between the previous reading and this one, 0 < frac <= 1
+            double frac = (double)(d->level_q8 - d->prev_q8) / (double)(x_q8 - d->prev_q8);
+            si8900_tstamp e = d->prev_t + (si8900_tstamp)llround(frac * (double)(int64_t)(t[i] - d->prev_t));
+
+            d->armed = 0;
+            if (dev == 0)
+            {
+                s->ref[s->ref_head & (SI8900_SYNC_REF_EDGES - 1)] = e;
+                s->ref_head++;
+            }
+            else
+            {
+                if (d->pend_head - d->pend_tail == SI8900_SYNC_PENDING)
+                {
+                    d->pend_tail++; // reference stalled, let the oldest go
+                }
+                d->pend[d->pend_head & (SI8900_SYNC_PENDING - 1)] = e;
+                d->pend_head++;
+            }
+            edges = 1;
+        }
+        d->prev_q8 = x_q8;
+        d->prev_t = t[i];
+    }
+
+    if (!edges)
+    {
+        return;
+    }
+    if (dev)
+    {
+        si8900_sync_pair(s, d);
+    }
+    else
+    {
+        for (i = 1; i < s->n_dev; i++)
+        {
+            si8900_sync_pair(s, &s->dev[i]);
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_sync_correct
+ *
+ *  desc: moves a device timestamp onto the reference time base
+ *
+ *  args:
+ *      const si8900_sync* s : service
+ *      uint8_t dev          : device the timestamp came from
+ *      si8900_tstamp t      : raw timestamp
+ *
+ *  return value:
+ *      si8900_tstamp: reference time, t unchanged for device 0 or before
+ *                     the first pair
+ *
+ *  example:
+ *      stamps[i] = si8900_sync_correct(&sy, dev, stamps[i]);
+ */
+si8900_tstamp si8900_sync_correct(const si8900_sync* s, uint8_t dev, si8900_tstamp t)
+{
+    const si8900_sync_dev* d;
+
+    if (dev == 0 || dev >= s->n_dev || !s->dev[dev].locked)
+    {
+        return t;
+    }
+    d = &s->dev[dev];
+    return (si8900_tstamp)((int64_t)t - (int64_t)llround(si8900_sync_predict(d, t)));
+}
+
+
+#ifdef SI8900_TSTAMP_
+/*
+ *  name: si8900_sync_update_block
+ *
+ *  desc: feeds the shared signal channel of a timestamped block
+ *
+ *  args:
+ *      si8900_sync* s           : service
+ *      uint8_t dev              : device
+ *      const si8900_block* blk  : block with raw timestamps
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_sync_update_block(&sy, dev, &blk);
+ *      si8900_sync_correct_block(&sy, dev, &blk);
+ */
+void si8900_sync_update_block(si8900_sync* s, uint8_t dev, const si8900_block* blk)
+{
+    si8900_reading r[SI8900_BLOCK_LEN];
+    uint16_t i;
+
+    for (i = 0; i < blk->count[s->inch]; i++)
+    {
+        r[i].cmd_byte = blk->cmd_byte[s->inch];
+        r[i].inch = s->inch;
+        r[i].reading = blk->reading[s->inch][i];
+    }
+    si8900_sync_update(s, dev, r, blk->tstamp[s->inch], blk->count[s->inch]);
+}
+
+
+/*
+ *  name: si8900_sync_correct_block
+ *
+ *  desc: moves every timestamp of a block onto the reference time base
+ *
+ *  args:
+ *      const si8900_sync* s : service
+ *      uint8_t dev          : device the block came from
+ *      si8900_block* blk    : block, corrected in place
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_sync_correct_block(&sy, dev, &blk);
+ *      si8900_merge_push_block(&m, dev, &blk);
+ */
+void si8900_sync_correct_block(const si8900_sync* s, uint8_t dev, si8900_block* blk)
+{
+    uint16_t i;
+    uint8_t ch;
+
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        for (i = 0; i < blk->count[ch]; i++)
+        {
+            blk->tstamp[ch][i] = si8900_sync_correct(s, dev, blk->tstamp[ch][i]);
+        }
+    }
+}
+#endif
+
+
+/*
+ *  name: si8900_sync_rand
+ *
+ *  desc: fixed sequence LCG for the self-check, uniform in [0, 1)
+ */
+static double si8900_sync_rand(uint32_t* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (double)(*seed >> 8) / 16777216.0;
+}
+
+
+/*
+ *  name: si8900_sync_selftest
+ *
+ *  desc: simulates 600 s of three devices watching 50 Hz mains at 3 kHz,
+ *        64 readings per block. Devices 1 and 2 run 45 ppm fast and
+ *        30 ppm slow with 3.2 ms and -1.7 ms offsets, every block picks
+ *        up 0 to 0.5 ms of USB latency, and device 2's latency steps up
+ *        by a lasting 3 ms half way. The random sequence is fixed, so the
+ *        run is the same every time. Takes a fraction of a second.
+ *
+ *  args:
+ *      void
+ *
+ *  return value:
+ *      uint8_t with value 0 when both drifts end within 1 ppm, the step
+ *      restarted the fit after exactly SI8900_SYNC_RELOCK rejected pairs
+ *      and the corrected times end within the gate; FAILED otherwise
+ *
+ *  example:
+ *      if (si8900_sync_selftest())
+ *      {
+ *          // throw error
+ *      }
+ */
+uint8_t si8900_sync_selftest(void)
+{
+    static const double ppm[3] = {0.0, 45.0, -30.0};
+    static const double off_ns[3] = {0.0, 3.2e6, -1.7e6};
+    const double fs = 3000.0, step_ns = 3e6, jitter_ns = 5e5;
+    const si8900_tstamp t_base = 1700000000000000000ULL;
+    const uint32_t blocks = (uint32_t)(600.0 * fs / 64);
+    const uint32_t step_at = (uint32_t)(300.0 * fs); // reading the latency step starts at
+    si8900_sync sy;
+    si8900_reading r[64];
+    si8900_tstamp ts[64];
+    uint32_t seed = 7, b, rej_at_step = 0, relocks = 0, rej_at_relock = 0;
+    uint8_t d, i;
+
+    if (si8900_sync_init(&sy, 3, SI8900_SYNC_MAINS, 2, 0, 8000000, 1000000))
+    {
+        return FAILED;
+    }
+    for (b = 0; b < blocks; b++)
+    {
+        for (d = 0; d < 3; d++)
+        {
+            double lat = si8900_sync_rand(&seed) * jitter_ns;
+            uint32_t pairs = sy.dev[2].pairs; // any update may pair device 2's edges
+
+            if (d == 2 && b == step_at / 64)
+            {
+                rej_at_step = sy.dev[d].rejected;
+            }
+            for (i = 0; i < 64; i++)
+            {
+                double t = (b * 64.0 + i) / fs;
+                double v = 512.0 + 300.0 * sin(2.0 * 3.14159265358979323846 * 50.0 * t);
+                double dev_ns = t * 1e9 * (1.0 + ppm[d] * 1e-6) + off_ns[d] + lat;
+
+                if (d == 2 && b * 64 + i >= step_at)
+                {
+                    dev_ns += step_ns;
+                }
+                r[i].cmd_byte = GP_SINGLE_READ_2;
+                r[i].inch = 2;
+                r[i].reading = (uint16_t)(v + 2.0 * si8900_sync_rand(&seed) - 0.5); // +-1 count of noise
+                ts[i] = t_base + (si8900_tstamp)(dev_ns + 0.5);
+            }
+            si8900_sync_update(&sy, d, r, ts, 64);
+            if (sy.dev[2].pairs < pairs && !relocks++)
+            {
+                rej_at_relock = sy.dev[2].rejected;
+            }
+        }
+    }
+
+    if (relocks != 1 || rej_at_relock - rej_at_step != SI8900_SYNC_RELOCK)
+    {
+        return FAILED;
+    }
+    for (d = 1; d < 3; d++)
+    {
+        double t = blocks * 64.0 / fs;
+        double dev_ns = t * 1e9 * (1.0 + ppm[d] * 1e-6) + off_ns[d] + ((d == 2) ? step_ns : 0.0);
+        si8900_tstamp ref = t_base + (si8900_tstamp)(t * 1e9 + 0.5);
+        double err = (double)(int64_t)(si8900_sync_correct(&sy, d, t_base + (si8900_tstamp)(dev_ns + 0.5)) - ref);
+
+        // the latency mean (jitter / 2) is indistinguishable from offset
+        if (fabs(sy.dev[d].drift * 1e6 - ppm[d]) > 1.0 || fabs(err - jitter_ns / 2.0) > (double)sy.gate_ns)
+        {
+            return FAILED;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * si8900_sync.h
+ * clock alignment between si8900 devices (host only).
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  Requires the PC_ build option.
+ *
+ *  Every si8900 sits behind its own USB-UART with its own latency, so the
+ *  host timestamps of different devices drift apart. Device 0 is the
+ *  reference; for every other device the offset (device time minus
+ *  reference time) and its drift are tracked and removed with
+ *  si8900_sync_correct.
+ *
+ *  All devices watch the same signal on one INCH, either
+ *      SI8900_SYNC_MAINS : the same mains phase wired to each device, its
+ *                          rising zero crossings (DC removed as in
+ *                          si8900_freq) are the events
+ *      SI8900_SYNC_PULSE : a shared sync pulse, its rising edges through
+ *                          a fixed level are the events
+ *  Edge times are interpolated between readings. Each device edge is
+ *  paired with the nearest reference edge after taking the predicted
+ *  offset off -- the peak of the cross correlation of the two edge
+ *  trains. Until the first pair the offset must lie within match_ns of
+ *  zero, so keep match_ns under half the event spacing (10 ms for 50 Hz
+ *  mains). After that, drift is followed for as long as events keep
+ *  coming.
+ *
+ *  The offset and drift are run through an alpha-beta filter. The first
+ *  pairs are fitted by least squares (expanding memory gains) for a quick
+ *  start; once that is slower than time constant SI8900_SYNC_TAU_S the gain
+ *  follows the time between events, so 50 Hz crossings and a 1 Hz pulse
+ *  settle alike, with Benedict-Bordner gains (beta = alpha^2 / (2 - alpha)). Residuals larger than gate_ns (once settled) are dropped
+ *  as outliers -- eg: a block that sat in a USB buffer. After
+ *  SI8900_SYNC_RELOCK of them in a row the fit starts over from the latest
+ *  pair. O(1) per reading, a few float operations per event.
+ *
+ *  A pulse edge is a step, which the readings only place to within one
+ *  reading period; a mains crossing is placed far better.
+ *
+ *  si8900_sync_selftest replays a fixed 600 s, three device mains run with
+ *  drift, USB latency jitter and a latency step, and checks the drift
+ *  estimates and the relock. Run it after changing the filter or gains.
+ */
+
+#ifndef si8900_sync_H_
+#define si8900_sync_H_
+
+#ifndef PC_
+    #error "si8900_sync is host only. \"PC_\" Must be defined."
+#endif
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h", si8900_tstamp
+#include "si8900_freq.h"  // SI8900_FREQ_DC_SHIFT
+
+
+#define SI8900_SYNC_MAINS 0
+#define SI8900_SYNC_PULSE 1
+
+#define SI8900_SYNC_MAX_DEV   16
+#define SI8900_SYNC_REF_EDGES 64    // reference edges kept for pairing, power of 2
+#define SI8900_SYNC_PENDING   16    // unpaired edges per device, power of 2
+#define SI8900_SYNC_HYST      16    // counts below the level that arm an edge
+#define SI8900_SYNC_SETTLE    8     // pairs before outliers are dropped
+#define SI8900_SYNC_RELOCK    32    // outliers in a row that restart the fit
+#ifndef SI8900_SYNC_TAU_S
+    #define SI8900_SYNC_TAU_S 10.0  // filter time constant, seconds
+#endif
+
+
+/*
+ * PER DEVICE STATE
+ */
+typedef struct si8900_sync_dev{
+    // edge detector, values suffixed _q8 have 8 fractional bits
+    int32_t level_q8;       // mains DC estimate or the pulse level
+    int32_t prev_q8;
+    si8900_tstamp prev_t;
+    uint32_t warm;          // readings seen, stops once edges are looked for
+    uint8_t armed;
+    // edges waiting for a reference edge
+    si8900_tstamp pend[SI8900_SYNC_PENDING];
+    uint32_t pend_head;
+    uint32_t pend_tail;
+    // filter
+    uint8_t locked;
+    double offset_ns;       // device minus reference at t_fix
+    double drift;           // ns per ns
+    si8900_tstamp t_fix;    // reference time of the last pair
+    uint32_t pairs;         // pairs fitted since (re)locking
+    uint32_t rejected;
+    uint32_t missed;        // pairs rejected in a row
+}si8900_sync_dev;
+
+
+/*
+ * ALIGNMENT SERVICE
+ */
+typedef struct si8900_sync{
+    uint8_t mode;           // SI8900_SYNC_MAINS or SI8900_SYNC_PULSE
+    uint8_t inch;           // channel carrying the shared signal
+    uint8_t n_dev;
+    si8900_tstamp match_ns;
+    si8900_tstamp gate_ns;
+    si8900_tstamp ref[SI8900_SYNC_REF_EDGES];
+    uint32_t ref_head;      // reference edges seen
+    si8900_sync_dev dev[SI8900_SYNC_MAX_DEV];
+}si8900_sync;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_sync_init(si8900_sync*, uint8_t, uint8_t, uint8_t, uint16_t, si8900_tstamp, si8900_tstamp);
+void si8900_sync_update(si8900_sync*, uint8_t, const si8900_reading*, const si8900_tstamp*, size_t);
+si8900_tstamp si8900_sync_correct(const si8900_sync*, uint8_t, si8900_tstamp);
+uint8_t si8900_sync_selftest(void);
+#ifdef SI8900_TSTAMP_
+void si8900_sync_update_block(si8900_sync*, uint8_t, const si8900_block*);
+void si8900_sync_correct_block(const si8900_sync*, uint8_t, si8900_block*);
+#endif
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_sync_H_ */
@@ -0,0 +1,201 @@
+/*
+ * si8900_window.c
+ * implementation file for the si8900 sliding window aggregator.
+ * Author: Danyal Ahsanullah
+ */
+#include "si8900_window.h" // includes "si8900_block.h"
+
+
+/*
+ *  name: si8900_agg_init
+ *
+ *  desc: sets up a sliding window aggregator for one channel
+ *
+ *  args:
+ *      si8900_agg* a          : aggregator to set up
+ *      uint16_t* hist         : history ring of hist_len readings
+ *      uint32_t hist_len      : power of 2, at least the longest window
+ *      uint32_t* dq_mem       : SI8900_AGG_DQ_WORDS(hist_len, n_win) words
+ *      const uint32_t* lens   : window lengths in readings
+ *      uint8_t n_win          : number of windows, up to SI8900_AGG_MAX_WIN
+ *
+ *  return value:
+ *      uint8_t with value 0 on success, FAILED on a bad length or window count
+ *
+ *  example:
+ *      static uint16_t hist[32768];
+ *      static uint32_t dq[SI8900_AGG_DQ_WORDS(32768, 3)];
+ *      uint32_t lens[3] = {300, 3000, 30000}; // 100 ms / 1 s / 10 s at 3 kHz
+ *      si8900_agg agg;
+ *      si8900_agg_init(&agg, hist, 32768, dq, lens, 3);
+ */
+uint8_t si8900_agg_init(si8900_agg* a, uint16_t* hist, uint32_t hist_len, uint32_t* dq_mem,
+                        const uint32_t* lens, uint8_t n_win)
+{
+    uint8_t w;
+
+    if (!hist_len || (hist_len & (hist_len - 1)) || n_win > SI8900_AGG_MAX_WIN)
+    {
+        return FAILED;
+    }
+    for (w = 0; w < n_win; w++)
+    {
+        if (lens[w] == 0 || lens[w] > hist_len)
+        {
+            return FAILED;
+        }
+    }
+
+    a->hist = hist;
+    a->mask = hist_len - 1;
+    a->seq = 0;
+    a->fill = 0;
+    a->n_win = n_win;
+    for (w = 0; w < n_win; w++)
+    {
+        si8900_agg_win* win = &a->win[w];
+        win->len = lens[w];
+        win->sum = 0;
+        win->sum_sq = 0;
+        win->dq_min = dq_mem + 2UL * w * hist_len;
+        win->dq_max = win->dq_min + hist_len;
+        win->min_head = win->min_tail = 0;
+        win->max_head = win->max_tail = 0;
+    }
+    return 0;
+}
+
+
+/*
+ *  name: si8900_agg_push
+ *
+ *  desc: adds one reading to every window of the aggregator
+ *
+ *  args:
+ *      si8900_agg* a    : aggregator
+ *      uint16_t reading : next reading of the channel
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_agg_push(&agg[reading.inch], reading.reading);
+ */
+void si8900_agg_push(si8900_agg* a, uint16_t reading)
+{
+    uint32_t seq = a->seq;
+    uint32_t mask = a->mask;
+    uint8_t w;
+
+    for (w = 0; w < a->n_win; w++)
+    {
+        si8900_agg_win* win = &a->win[w];
+
+        // reading leaving the window, still in the history ring
+        if (a->fill >= win->len)
+        {
+            uint32_t old_seq = seq - win->len;
+            uint16_t old = a->hist[old_seq & mask];
+            win->sum -= old;
+            win->sum_sq -= (uint32_t)old * old;
+            if (win->min_head != win->min_tail && win->dq_min[win->min_head & mask] == old_seq)
+            {
+                win->min_head++;
+            }
+            if (win->max_head != win->max_tail && win->dq_max[win->max_head & mask] == old_seq)
+            {
+                win->max_head++;
+            }
+        }
+
+        win->sum += reading;
+        win->sum_sq += (uint32_t)reading * reading;
+        while (win->min_head != win->min_tail && a->hist[win->dq_min[(win->min_tail - 1) & mask] & mask] >= reading)
+        {
+            win->min_tail--;
+        }
+        win->dq_min[win->min_tail++ & mask] = seq;
+        while (win->max_head != win->max_tail && a->hist[win->dq_max[(win->max_tail - 1) & mask] & mask] <= reading)
+        {
+            win->max_tail--;
+        }
+        win->dq_max[win->max_tail++ & mask] = seq;
+    }
+
+    a->hist[seq & mask] = reading;
+    a->seq = seq + 1;
+    if (a->fill <= mask)
+    {
+        a->fill++;
+    }
+}
+
+
+/*
+ *  name: si8900_agg_push_block
+ *
+ *  desc: pushes every channel row of a sample block into the matching
+ *        aggregator
+ *
+ *  args:
+ *      si8900_agg aggs[SI8900_NUM_CH] : one aggregator per channel
+ *      const si8900_block* blk        : block to push
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_agg_push_block(aggs, &blk);
+ */
+void si8900_agg_push_block(si8900_agg aggs[SI8900_NUM_CH], const si8900_block* blk)
+{
+    uint8_t ch;
+    uint16_t i;
+    for (ch = 0; ch < SI8900_NUM_CH; ch++)
+    {
+        for (i = 0; i < blk->count[ch]; i++)
+        {
+            si8900_agg_push(&aggs[ch], blk->reading[ch][i]);
+        }
+    }
+}
+
+
+/*
+ *  name: si8900_agg_query
+ *
+ *  desc: statistics of one window, constant time
+ *
+ *  args:
+ *      const si8900_agg* a    : aggregator
+ *      uint8_t w              : window index, in the order given to init
+ *      si8900_agg_stats* out  : statistics out, all zero before the first reading
+ *
+ *  return value:
+ *      void
+ *
+ *  example:
+ *      si8900_agg_stats st;
+ *      si8900_agg_query(&agg, 1, &st); // 1 s window
+ *      show(st.min, st.max, st.mean_q8 >> 8);
+ */
+void si8900_agg_query(const si8900_agg* a, uint8_t w, si8900_agg_stats* out)
+{
+    const si8900_agg_win* win = &a->win[w];
+    uint32_t n = (a->fill < win->len) ? a->fill : win->len;
+    uint64_t spread;
+
+    out->n = n;
+    if (!n)
+    {
+        out->min = out->max = 0;
+        out->mean_q8 = out->var_q8 = 0;
+        return;
+    }
+    out->min = a->hist[win->dq_min[win->min_head & a->mask] & a->mask];
+    out->max = a->hist[win->dq_max[win->max_head & a->mask] & a->mask];
+    out->mean_q8 = (uint32_t)(((uint64_t)win->sum << 8) / n);
+    // n * variance, off by less than one count^2
+    spread = win->sum_sq - ((uint64_t)win->sum * win->sum) / n;
+    out->var_q8 = (uint32_t)((spread << 8) / n);
+}
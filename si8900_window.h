@@ -0,0 +1,98 @@
+/*
+ * si8900_window.h
+ * O(1) sliding window min/max/mean/variance aggregator per channel.
+ * Author: Danyal Ahsanullah
+ *
+ * NOTES:
+ *  One si8900_agg per channel keeps a history ring of the last readings
+ *  and up to SI8900_AGG_MAX_WIN windows of different lengths over it.
+ *  Per reading and window (amortised O(1)):
+ *      - min/max : monotonic deques of reading sequence numbers (32 bit,
+ *                  compared modulo 2^32, so they may wrap)
+ *      - mean    : running sum
+ *      - variance: running sum of squares
+ *  Readings are 10 bit integers, so the running sums are exact and do not
+ *  drift like floating point sums would -- no Welford update is needed.
+ *  Queries are constant time.
+ *
+ *  Memory is handed in by the caller (no allocation):
+ *      history : hist_len readings, hist_len a power of 2 >= longest window
+ *      deques  : SI8900_AGG_DQ_WORDS(hist_len, n_win) uint32_t words
+ *
+ *  Optional values: -- define in build config
+ *      SI8900_AGG_MAX_WIN : windows per channel (default 3)
+ */
+
+#ifndef si8900_window_H_
+#define si8900_window_H_
+
+/*
+ * includes
+ */
+#include "si8900_block.h" // includes "si8900.h"
+
+
+#ifndef SI8900_AGG_MAX_WIN
+    #define SI8900_AGG_MAX_WIN  3
+#endif
+
+
+/*
+ * deque memory needed for n_win windows over a hist_len history
+ */
+#define SI8900_AGG_DQ_WORDS(hist_len, n_win)    (2UL * (n_win) * (hist_len))
+
+
+/*
+ * one window over the history
+ */
+typedef struct si8900_agg_win{
+    uint32_t len;           // readings in the window
+    uint32_t sum;
+    uint64_t sum_sq;
+    uint32_t* dq_min;       // sequence numbers, values increasing front to back
+    uint32_t* dq_max;       // sequence numbers, values decreasing front to back
+    uint32_t min_head, min_tail;
+    uint32_t max_head, max_tail;
+}si8900_agg_win;
+
+
+/*
+ * per channel aggregator
+ */
+typedef struct si8900_agg{
+    uint16_t* hist;         // history ring, indexed by sequence number & mask
+    uint32_t mask;
+    uint32_t seq;           // sequence number of the next reading, wraps
+    uint32_t fill;          // readings pushed so far, stops at the history length
+    uint8_t n_win;
+    si8900_agg_win win[SI8900_AGG_MAX_WIN];
+}si8900_agg;
+
+
+/*
+ * query result, mean and variance with 8 fractional bits
+ */
+typedef struct si8900_agg_stats{
+    uint32_t n;             // readings in the window so far (< len until it fills)
+    uint16_t min;
+    uint16_t max;
+    uint32_t mean_q8;
+    uint32_t var_q8;
+}si8900_agg_stats;
+
+
+/*
+ * START: Function prototypes / declarations
+ */
+
+uint8_t si8900_agg_init(si8900_agg*, uint16_t*, uint32_t, uint32_t*, const uint32_t*, uint8_t);
+void si8900_agg_push(si8900_agg*, uint16_t);
+void si8900_agg_push_block(si8900_agg[SI8900_NUM_CH], const si8900_block*);
+void si8900_agg_query(const si8900_agg*, uint8_t, si8900_agg_stats*);
+
+/*
+ * END: Function prototypes / declarations
+ */
+
+#endif /* si8900_window_H_ */